@@ -19,6 +19,11 @@ namespace PTA{
             return std::tie(var, scope, line) < std::tie(rhs.var, rhs.scope, rhs.line);
         }
     };
+
+    // Heap memory held by the strings of a PtrDataT (see lhf::heap_bytes).
+    inline std::size_t heap_bytes(const PtrDataT& data) {
+        return lhf::heap_bytes(data.var) + lhf::heap_bytes(data.scope) + lhf::heap_bytes(data.line);
+    }
     using NodeIdT = unsigned int;
     using EdgeT = std::pair<NodeIdT, NodeIdT>;
 
@@ -28,14 +33,26 @@ namespace PTA{
     };
 
 
-    template<typename NodeDataT, typename DerivedGraphT>
+    // NodeBackend and EdgeBackend pick the property set representation of
+    // the node and edge forests separately (see lhf::SortedVectorBackend).
+    template<
+        typename NodeDataT,
+        typename DerivedGraphT,
+        typename NodeBackend = lhf::DefaultBackend,
+        typename EdgeBackend = lhf::DefaultBackend>
     class BaseGraphAPI {
     protected:
         using NodePropertyT = unsigned int;
         using EdgePropertyT = long long;
 
-        using NodeHashForest = lhf::LatticeHashForest<NodePropertyT>;
-        using EdgeHashForest = lhf::LatticeHashForest<EdgePropertyT>;
+        using NodeHashForest = lhf::LatticeHashForest<
+            NodePropertyT, lhf::HintNone,
+            std::less<NodePropertyT>, std::equal_to<NodePropertyT>,
+            NodeBackend>;
+        using EdgeHashForest = lhf::LatticeHashForest<
+            EdgePropertyT, lhf::HintNone,
+            std::less<EdgePropertyT>, std::equal_to<EdgePropertyT>,
+            EdgeBackend>;
     
         EdgeHashForest edgeForest;
         NodeHashForest nodeForest;
@@ -88,18 +105,18 @@ namespace PTA{
     
         inline bool is_subset(IndexType indexType, lhf::Index a, lhf::Index b) {
             if (indexType == EDGE_FOREST) {
-                return edgeForest.is_subset(a, b) == EdgeHashForest::SubsetRelation::SUBSET;
+                return edgeForest.is_subset_of(a, b);
             } else if (indexType == NODE_FOREST) {
-                return nodeForest.is_subset(a, b) == NodeHashForest::SubsetRelation::SUBSET;
+                return nodeForest.is_subset_of(a, b);
             }
             throw std::invalid_argument("Invalid index type");
         }
 
         inline bool is_superset(IndexType indexType, lhf::Index a, lhf::Index b) {
             if (indexType == EDGE_FOREST) {
-                return edgeForest.is_subset(a, b) == EdgeHashForest::SubsetRelation::SUPERSET;
+                return edgeForest.is_subset_of(b, a);
             } else if (indexType == NODE_FOREST) {
-                return nodeForest.is_subset(a, b) == NodeHashForest::SubsetRelation::SUPERSET;
+                return nodeForest.is_subset_of(b, a);
             }
             throw std::invalid_argument("Invalid index type");
         }
@@ -112,11 +129,11 @@ namespace PTA{
             return edgeForest.register_set_single(getEdgeProperty(edge), cold);
         }
     
-        inline const EdgeHashForest::PropertySet &get_value_edge(lhf::Index idx) const {
+        inline typename EdgeHashForest::PropertySetView get_value_edge(lhf::Index idx) const {
             return edgeForest.get_value(idx);
         }
 
-        inline const NodeHashForest::PropertySet &get_value_node(lhf::Index idx) const {
+        inline typename NodeHashForest::PropertySetView get_value_node(lhf::Index idx) const {
             return nodeForest.get_value(idx);
         }
     
@@ -180,33 +197,55 @@ namespace PTA{
             throw std::invalid_argument("Invalid index type");
         }
     
-        inline const NodeHashForest::PropertySet& get_value_points_to(lhf::Index idx) const {
+        inline typename NodeHashForest::PropertySetView get_value_points_to(lhf::Index idx) const {
             return nodeForest.get_value(idx);
         }
     
         lhf::Index get_points_to_set(lhf::Index a, NodeIdT node_id) {
-            EdgeHashForest::PropertySet property_set = edgeForest.get_value(a);
-            std::vector<NodeIdT> result;
-            for (EdgePropertyT property : property_set) {
-                EdgeT edge = getEdge(property);
-                if (edge.first == node_id) {
-                    result.push_back(edge.second);
+            __lhf_calc_functime_operands(a, node_id);
+            // Edges are ordered by their source first (see getEdgeProperty),
+            // so the ones leaving node_id form a single run of the set.
+            const EdgePropertyT first = static_cast<EdgePropertyT>(node_id) << 32;
+            auto locate = [&](EdgePropertyT property) {
+                if (getEdge(property).first == node_id) {
+                    return 0;
                 }
+                return property < first ? -1 : 1;
+            };
+            typename NodeHashForest::PropertySet result;
+            if constexpr (EdgeBackend::ORDERED) {
+                edgeForest.for_each_in_range(a, locate,
+                    [&](EdgePropertyT property) {
+                        LHF_PUSH_ONE(result, getEdge(property).second);
+                    });
+            } else {
+                // An unordered edge forest yields the edges in no particular
+                // order, but the node forest may need its sets in ascending
+                // order. Each destination appears once, so sorting suffices.
+                std::vector<NodePropertyT> nodes;
+                edgeForest.for_each_in_range(a, locate,
+                    [&](EdgePropertyT property) {
+                        nodes.push_back(getEdge(property).second);
+                    });
+                std::sort(nodes.begin(), nodes.end());
+                LHF_PUSH_RANGE(result, nodes.begin(), nodes.end());
             }
+            __lhf_record("get_points_to_set size", result.size());
             return nodeForest.register_set(result);
         }
     
         lhf::Index get_points_to_set(lhf::Index a, const std::vector<NodeIdT>& node_ids) {
-            lhf::Index result = getEmptySetIndex();
+            std::vector<lhf::Index> indices;
+            indices.reserve(node_ids.size());
             for (NodeIdT node_id : node_ids) {
-                lhf::Index index = get_points_to_set(a, node_id);
-                result = nodeForest.set_union(result, index);
+                indices.push_back(get_points_to_set(a, node_id));
             }
-            return result;
+            return nodeForest.set_union_many(indices);
         }
     
         lhf::Index get_points_to_set(lhf::Index a, lhf::Index idx) {
-            return get_points_to_set(a, get_value_points_to(idx));
+            typename NodeHashForest::PropertySetView node_ids = get_value_points_to(idx);
+            return get_points_to_set(a, std::vector<NodeIdT>(node_ids.begin(), node_ids.end()));
         }
     
         lhf::Index get_points_to_set(lhf::Index a, NodeIdT node_id, unsigned int recursion_depth) {
@@ -235,6 +274,65 @@ namespace PTA{
             for (const auto& v : set) std::cout << v << ", ";
             std::cout << ")" << std::endl;
         }
+
+        // Memory held by both forests and by the graph's own containers, in
+        // bytes (see lhf::LatticeHashForest::memory_usage).
+        struct MemoryUsage {
+            lhf::MemoryUsage node_forest;
+            lhf::MemoryUsage edge_forest;
+            std::size_t graph = 0;
+            std::size_t node_map = 0;
+
+            std::size_t total() const {
+                return node_forest.total() + edge_forest.total() + graph + node_map;
+            }
+
+            std::string to_string() const {
+                std::stringstream s;
+                s << "Node Forest:\n" << node_forest.to_string()
+                  << "Edge Forest:\n" << edge_forest.to_string()
+                  << "Graph   : " << graph << "\n"
+                  << "Node Map: " << node_map << "\n"
+                  << "Total   : " << total() << "\n";
+                return s.str();
+            }
+        };
+
+        MemoryUsage memory_usage() const {
+            MemoryUsage m;
+            m.node_forest = nodeForest.memory_usage();
+            m.edge_forest = edgeForest.memory_usage();
+            m.graph = sizeof(getGraph()) + lhf::heap_bytes(getGraph());
+            m.node_map = sizeof(getNodeMap()) + lhf::heap_bytes(getNodeMap());
+            return m;
+        }
+
+        // Statistics of both forests as JSON (see
+        // lhf::LatticeHashForest::dump_perf_json), along with the size of
+        // the graph. `benchmark` and `analysis` are written as given, to join
+        // the output with the stats/*.stats.json files of the same run. The
+        // sizes use their own keys, since the node map does not hold the
+        // same nodes as total_nodes in those files.
+        std::string dump_perf_json(const std::string &benchmark, const std::string &analysis) {
+            lhf::JsonWriter w;
+            w.begin_object()
+             .value("benchmark", benchmark)
+             .value("analysis", analysis)
+             .value("node_map_size", getNodeMap().size())
+             .value("edge_count", getGraph().size());
+            w.begin_object("node_forest");
+            nodeForest.write_perf_json(w);
+            w.end_object().begin_object("edge_forest");
+            edgeForest.write_perf_json(w);
+            w.end_object();
+#ifdef LHF_ENABLE_PROFILER
+            w.begin_object("profiler");
+            lhf::__stat.write_json(w);
+            w.end_object();
+#endif
+            w.end_object();
+            return w.str();
+        }
     };
 
 
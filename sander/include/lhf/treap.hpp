@@ -0,0 +1,678 @@
+#ifndef LHF_TREAP_HPP
+#define LHF_TREAP_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "lhf_config.hpp"
+
+namespace lhf {
+
+/**
+ * @brief      Persistent set stored as a treap with hash-consed nodes.
+ *
+ *             The priority of a node is the hash of its value, so the shape
+ *             of a treap depends only on the values it holds. Nodes are also
+ *             unique: building a node with the same value and children as an
+ *             existing one returns the existing node. Together these mean
+ *             that equal sets, and equal subtrees, are the very same nodes.
+ *             Sets that differ in a few values share everything else, and
+ *             comparing two sets is comparing two pointers.
+ *
+ *             Sets are never changed in place. An operation builds new nodes
+ *             along the paths it changes and reuses every other subtree, and
+ *             union, intersection and difference stop as soon as both sides
+ *             are the same subtree. Nodes are reference counted, and are
+ *             freed once no set uses them.
+ *
+ *             Every node keeps the size of its subtree and the sum of the
+ *             hashes of its values, so `size()` and `hash()` are O(1).
+ *             Iteration is in ascending order of value.
+ *
+ *             All sets of a type share one node table, whichever forest they
+ *             belong to. The table is therefore always locked and reference
+ *             counts are always atomic, even without LHF_ENABLE_CONCURRENCY,
+ *             since separate forests may be used on separate threads.
+ *
+ * @tparam     T       The element type.
+ * @tparam     Less    Strict ordering of elements.
+ * @tparam     Hash    Hashes an element. Hashes are used as priorities, so
+ *                     they must be well mixed.
+ */
+template<typename T, typename Less, typename Hash>
+struct Treap {
+	using value_type = T;
+
+	struct Node {
+		T value;
+		std::atomic<std::uint32_t> refs;
+		// Number of values in the subtree.
+		std::uint32_t size;
+
+		// Sum of the hashes of the values in the subtree.
+		std::size_t hash;
+
+		Node *left;
+		Node *right;
+
+		// The next node in the same bucket of the node table, or on the free
+		// list.
+		Node *next;
+	};
+
+#ifdef LHF_ENABLE_CONCURRENCY
+	static const constexpr std::size_t SHARD_COUNT = LHF_CONCURRENT_SHARD_COUNT;
+#else
+	static const constexpr std::size_t SHARD_COUNT = 1;
+#endif
+
+	// Nodes are allocated this many at a time.
+	static const constexpr std::size_t SLAB_NODES = 1024;
+
+	static const constexpr std::size_t INITIAL_BUCKETS = 64;
+
+	/**
+	 * @brief      One independently locked part of the node table: a chained
+	 *             hash table of the live nodes, and the slabs and free list
+	 *             they are allocated from.
+	 */
+	struct Shard {
+		std::mutex mutex;
+		std::vector<Node *> buckets = {};
+		std::size_t count = 0;
+		Node *free_list = nullptr;
+		std::vector<std::unique_ptr<Node[]>> slabs = {};
+	};
+
+	struct NodeTable {
+		Shard shards[SHARD_COUNT];
+	};
+
+	/**
+	 * @brief      The node table shared by all sets of this type. It is never
+	 *             destroyed, so sets in static objects can still release their
+	 *             nodes at exit.
+	 */
+	static NodeTable &table() {
+		static NodeTable *t = new NodeTable();
+		return *t;
+	}
+
+	static inline bool equal(const T &a, const T &b) {
+		return !Less()(a, b) && !Less()(b, a);
+	}
+
+	static inline std::size_t size_of(const Node *n) {
+		return n == nullptr ? 0 : n->size;
+	}
+
+	static inline std::size_t hash_of(const Node *n) {
+		return n == nullptr ? 0 : n->hash;
+	}
+
+	/**
+	 * @brief      Whether a node holding `a` (with hash `ha`) belongs above
+	 *             one holding `b`. Ties between hashes are broken by value,
+	 *             so the order is total.
+	 */
+	static inline bool above(const T &a, std::size_t ha, const T &b, std::size_t hb) {
+		return ha > hb || (ha == hb && Less()(b, a));
+	}
+
+	static inline bool above(const Node *a, const Node *b) {
+		return above(a->value, Hash()(a->value), b->value, Hash()(b->value));
+	}
+
+	// Identifies a node by its value and children, in the node table.
+	static inline std::size_t node_hash(std::size_t value_hash, const Node *left, const Node *right) {
+		std::uint64_t h = value_hash;
+		h += reinterpret_cast<std::uintptr_t>(left) * 0x9e3779b97f4a7c15ULL;
+		h += reinterpret_cast<std::uintptr_t>(right) * 0xc2b2ae3d27d4eb4fULL;
+		h ^= h >> 32;
+		return static_cast<std::size_t>(h);
+	}
+
+	static inline Shard &shard_for(std::size_t h) {
+		return table().shards[(h >> 20) & (SHARD_COUNT - 1)];
+	}
+
+	static inline void retain(Node *n) {
+		if (n != nullptr) {
+			n->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * @brief      Takes a reference to a node found in the node table, unless
+	 *             its last reference is already gone (it is then about to be
+	 *             unlinked, and must not be handed out again).
+	 */
+	static inline bool try_retain(Node *n) {
+		std::uint32_t refs = n->refs.load(std::memory_order_relaxed);
+		while (refs != 0) {
+			if (n->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static inline void release(Node *n) {
+		if (n == nullptr) {
+			return;
+		}
+
+		if (n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			destroy(n);
+		}
+	}
+
+	/**
+	 * @brief      Unlinks a node that has no references left, returns it to
+	 *             the free list, and releases its children.
+	 */
+	static void destroy(Node *n) {
+		Node *left = n->left;
+		Node *right = n->right;
+		const std::size_t h = node_hash(Hash()(n->value), left, right);
+		Shard &s = shard_for(h);
+
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			Node **cursor = &s.buckets[h & (s.buckets.size() - 1)];
+			while (*cursor != n) {
+				cursor = &(*cursor)->next;
+			}
+			*cursor = n->next;
+			s.count--;
+
+			n->next = s.free_list;
+			s.free_list = n;
+		}
+
+		release(left);
+		release(right);
+	}
+
+	/**
+	 * @brief      Owning reference to a node, where nullptr is the empty set.
+	 */
+	struct Ref {
+		Node *node = nullptr;
+
+		Ref() = default;
+
+		// Adopts a reference that the caller already holds.
+		explicit Ref(Node *n): node(n) {}
+
+		Ref(const Ref &other): node(other.node) {
+			retain(node);
+		}
+
+		Ref(Ref &&other) noexcept: node(other.node) {
+			other.node = nullptr;
+		}
+
+		Ref &operator=(Ref other) noexcept {
+			std::swap(node, other.node);
+			return *this;
+		}
+
+		~Ref() {
+			release(node);
+		}
+
+		inline Node *get() const {
+			return node;
+		}
+
+		// Gives up ownership of the reference.
+		inline Node *take() {
+			Node *n = node;
+			node = nullptr;
+			return n;
+		}
+	};
+
+	// Takes a new reference to `n`.
+	static inline Ref borrow(Node *n) {
+		retain(n);
+		return Ref(n);
+	}
+
+	static void grow(Shard &s) {
+		std::vector<Node *> old = std::move(s.buckets);
+		s.buckets.assign(old.empty() ? INITIAL_BUCKETS : old.size() * 2, nullptr);
+		const std::size_t mask = s.buckets.size() - 1;
+
+		for (Node *head : old) {
+			while (head != nullptr) {
+				Node *next = head->next;
+				const std::size_t h = node_hash(Hash()(head->value), head->left, head->right);
+				head->next = s.buckets[h & mask];
+				s.buckets[h & mask] = head;
+				head = next;
+			}
+		}
+	}
+
+	static Node *allocate(Shard &s) {
+		if (s.free_list == nullptr) {
+			s.slabs.emplace_back(new Node[SLAB_NODES]);
+			Node *slab = s.slabs.back().get();
+			for (std::size_t i = 0; i < SLAB_NODES; i++) {
+				slab[i].next = s.free_list;
+				s.free_list = &slab[i];
+			}
+		}
+
+		Node *n = s.free_list;
+		s.free_list = n->next;
+		return n;
+	}
+
+	/**
+	 * @brief      Returns the node with this value and children, creating it
+	 *             if it does not exist. The node takes over the references to
+	 *             the children.
+	 */
+	static Ref make(const T &value, Ref left, Ref right) {
+		const std::size_t value_hash = Hash()(value);
+		const std::size_t h = node_hash(value_hash, left.get(), right.get());
+		Shard &s = shard_for(h);
+		Node *ret = nullptr;
+
+		// `left` and `right` are released after the lock is dropped, since
+		// that may destroy nodes in this shard.
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+
+			if (!s.buckets.empty()) {
+				for (Node *n = s.buckets[h & (s.buckets.size() - 1)]; n != nullptr; n = n->next) {
+					if (n->left == left.get() && n->right == right.get() &&
+						equal(n->value, value) && try_retain(n)) {
+						ret = n;
+						break;
+					}
+				}
+			}
+
+			if (ret == nullptr) {
+				if (s.count >= s.buckets.size()) {
+					grow(s);
+				}
+
+				ret = allocate(s);
+				ret->value = value;
+				ret->refs.store(1, std::memory_order_relaxed);
+				ret->size = static_cast<std::uint32_t>(1 + size_of(left.get()) + size_of(right.get()));
+				ret->hash = value_hash + hash_of(left.get()) + hash_of(right.get());
+				ret->left = left.take();
+				ret->right = right.take();
+
+				Node *&bucket = s.buckets[h & (s.buckets.size() - 1)];
+				ret->next = bucket;
+				bucket = ret;
+				s.count++;
+			}
+		}
+
+		return Ref(ret);
+	}
+
+	/**
+	 * @brief      Splits `t` into the values less than `k` and those greater
+	 *             than `k`.
+	 *
+	 * @return     `true` if `k` itself is in `t`.
+	 */
+	static bool split(Node *t, const T &k, Ref &less, Ref &greater) {
+		if (t == nullptr) {
+			less = Ref();
+			greater = Ref();
+			return false;
+		}
+
+		if (Less()(k, t->value)) {
+			Ref inner;
+			bool found = split(t->left, k, less, inner);
+			greater = make(t->value, std::move(inner), borrow(t->right));
+			return found;
+		}
+
+		if (Less()(t->value, k)) {
+			Ref inner;
+			bool found = split(t->right, k, inner, greater);
+			less = make(t->value, borrow(t->left), std::move(inner));
+			return found;
+		}
+
+		less = borrow(t->left);
+		greater = borrow(t->right);
+		return true;
+	}
+
+	// Joins two treaps, where every value of `a` is less than every value
+	// of `b`.
+	static Ref join(Node *a, Node *b) {
+		if (a == nullptr) {
+			return borrow(b);
+		}
+
+		if (b == nullptr) {
+			return borrow(a);
+		}
+
+		if (above(a, b)) {
+			return make(a->value, borrow(a->left), join(a->right, b));
+		}
+
+		return make(b->value, join(a, b->left), borrow(b->right));
+	}
+
+	static Ref unite(Node *a, Node *b) {
+		if (a == nullptr) {
+			return borrow(b);
+		}
+
+		if (b == nullptr || a == b) {
+			return borrow(a);
+		}
+
+		if (above(b, a)) {
+			std::swap(a, b);
+		}
+
+		Ref less, greater;
+		split(b, a->value, less, greater);
+		return make(a->value,
+			unite(a->left, less.get()),
+			unite(a->right, greater.get()));
+	}
+
+	static Ref intersect(Node *a, Node *b) {
+		if (a == nullptr || b == nullptr) {
+			return Ref();
+		}
+
+		if (a == b) {
+			return borrow(a);
+		}
+
+		if (above(b, a)) {
+			std::swap(a, b);
+		}
+
+		Ref less, greater;
+		bool found = split(b, a->value, less, greater);
+		Ref left = intersect(a->left, less.get());
+		Ref right = intersect(a->right, greater.get());
+
+		if (found) {
+			return make(a->value, std::move(left), std::move(right));
+		}
+		return join(left.get(), right.get());
+	}
+
+	static Ref subtract(Node *a, Node *b) {
+		if (a == nullptr || a == b) {
+			return Ref();
+		}
+
+		if (b == nullptr) {
+			return borrow(a);
+		}
+
+		Ref less, greater;
+		bool found = split(b, a->value, less, greater);
+		Ref left = subtract(a->left, less.get());
+		Ref right = subtract(a->right, greater.get());
+
+		if (found) {
+			return join(left.get(), right.get());
+		}
+		return make(a->value, std::move(left), std::move(right));
+	}
+
+	static bool contained(Node *a, Node *b) {
+		if (a == nullptr || a == b) {
+			return true;
+		}
+
+		if (b == nullptr || a->size > b->size) {
+			return false;
+		}
+
+		Ref less, greater;
+		if (!split(b, a->value, less, greater)) {
+			return false;
+		}
+
+		return contained(a->left, less.get()) && contained(a->right, greater.get());
+	}
+
+	// Adds `v`, which must not be in `t` yet.
+	static Ref insert_into(Node *t, const T &v, std::size_t hash) {
+		if (t == nullptr) {
+			return make(v, Ref(), Ref());
+		}
+
+		if (above(v, hash, t->value, Hash()(t->value))) {
+			Ref less, greater;
+			split(t, v, less, greater);
+			return make(v, std::move(less), std::move(greater));
+		}
+
+		if (Less()(v, t->value)) {
+			return make(t->value, insert_into(t->left, v, hash), borrow(t->right));
+		}
+		return make(t->value, borrow(t->left), insert_into(t->right, v, hash));
+	}
+
+	// Removes `v`, which must be in `t`.
+	static Ref erase_from(Node *t, const T &v) {
+		if (Less()(v, t->value)) {
+			return make(t->value, erase_from(t->left, v), borrow(t->right));
+		}
+
+		if (Less()(t->value, v)) {
+			return make(t->value, borrow(t->left), erase_from(t->right, v));
+		}
+
+		return join(t->left, t->right);
+	}
+
+	Ref root = {};
+
+	Treap() = default;
+
+	Treap(std::initializer_list<T> values) {
+		insert(values.begin(), values.end());
+	}
+
+	template<typename Iterator>
+	Treap(Iterator begin, Iterator end) {
+		insert(begin, end);
+	}
+
+	inline std::size_t size() const {
+		return size_of(root.get());
+	}
+
+	inline bool empty() const {
+		return root.get() == nullptr;
+	}
+
+	/**
+	 * @brief      The sum of the hashes of the values, as given by `Hash`.
+	 */
+	inline std::size_t hash() const {
+		return hash_of(root.get());
+	}
+
+	/**
+	 * @brief      Returns the bytes held by the node table, which all sets of
+	 *             this type share: the node slabs, whether their nodes are
+	 *             live or free, and the buckets.
+	 */
+	static std::size_t node_memory_usage() {
+		std::size_t bytes = 0;
+		for (Shard &s : table().shards) {
+			std::lock_guard<std::mutex> lock(s.mutex);
+			bytes += s.slabs.size() * SLAB_NODES * sizeof(Node);
+			bytes += s.slabs.capacity() * sizeof(std::unique_ptr<Node[]>);
+			bytes += s.buckets.capacity() * sizeof(Node *);
+		}
+		return bytes;
+	}
+
+	inline std::size_t count(const T &v) const {
+		for (const Node *n = root.get(); n != nullptr; ) {
+			if (Less()(v, n->value)) {
+				n = n->left;
+			} else if (Less()(n->value, v)) {
+				n = n->right;
+			} else {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	bool insert(const T &v) {
+		if (count(v)) {
+			return false;
+		}
+
+		root = insert_into(root.get(), v, Hash()(v));
+		return true;
+	}
+
+	template<typename Iterator>
+	void insert(Iterator begin, Iterator end) {
+		for (; begin != end; begin++) {
+			insert(*begin);
+		}
+	}
+
+	std::size_t erase(const T &v) {
+		if (!count(v)) {
+			return 0;
+		}
+
+		root = erase_from(root.get(), v);
+		return 1;
+	}
+
+	void clear() {
+		root = Ref();
+	}
+
+	bool operator==(const Treap &b) const {
+		return root.get() == b.root.get();
+	}
+
+	bool operator!=(const Treap &b) const {
+		return !(*this == b);
+	}
+
+	static Treap set_union(const Treap &a, const Treap &b) {
+		Treap r;
+		r.root = unite(a.root.get(), b.root.get());
+		return r;
+	}
+
+	static Treap set_intersection(const Treap &a, const Treap &b) {
+		Treap r;
+		r.root = intersect(a.root.get(), b.root.get());
+		return r;
+	}
+
+	static Treap set_difference(const Treap &a, const Treap &b) {
+		Treap r;
+		r.root = subtract(a.root.get(), b.root.get());
+		return r;
+	}
+
+	/**
+	 * @brief      Determines whether every value of `a` is also in `b`.
+	 *             Subtrees the two share are skipped without being visited.
+	 */
+	static bool is_subset(const Treap &a, const Treap &b) {
+		return contained(a.root.get(), b.root.get());
+	}
+
+	/**
+	 * @brief      Forward iterator over the values, in ascending order. It
+	 *             keeps the path of nodes still to be visited.
+	 */
+	struct const_iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T *;
+		using reference = const T &;
+
+		std::vector<const Node *> path = {};
+
+		inline void descend(const Node *n) {
+			for (; n != nullptr; n = n->left) {
+				path.push_back(n);
+			}
+		}
+
+		inline const T &operator*() const {
+			return path.back()->value;
+		}
+
+		inline const T *operator->() const {
+			return &path.back()->value;
+		}
+
+		inline const_iterator &operator++() {
+			const Node *n = path.back();
+			path.pop_back();
+			descend(n->right);
+			return *this;
+		}
+
+		inline const_iterator operator++(int) {
+			const_iterator ret = *this;
+			++(*this);
+			return ret;
+		}
+
+		inline bool operator==(const const_iterator &i) const {
+			if (path.empty() || i.path.empty()) {
+				return path.empty() == i.path.empty();
+			}
+			return path.back() == i.path.back();
+		}
+
+		inline bool operator!=(const const_iterator &i) const {
+			return !(*this == i);
+		}
+	};
+
+	using iterator = const_iterator;
+
+	const_iterator begin() const {
+		const_iterator i;
+		i.descend(root.get());
+		return i;
+	}
+
+	const_iterator end() const {
+		return const_iterator();
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,665 @@
+#ifndef LHF_BITMAP_HPP
+#define LHF_BITMAP_HPP
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace lhf {
+
+/**
+ * @brief      Compressed bitmap set of integers, in the style of Roaring
+ *             bitmaps.
+ *
+ *             Values are split into a high part and a 16-bit low part. All
+ *             values sharing a high part live in one container, which is
+ *             either a sorted array of low parts (for sparse chunks) or a
+ *             65536-bit bitmap (for dense chunks). Set operations work one
+ *             container pair at a time, and bitmap containers are combined a
+ *             machine word at a time.
+ *
+ *             Iteration is in ascending order of value, so this can be used
+ *             wherever an ordered container is expected.
+ *
+ * @tparam     T     The element type. Must be an integer type.
+ */
+template<typename T>
+struct Bitmap {
+	static_assert(std::is_integral<T>::value, "Bitmap sets can only hold integers");
+
+	using value_type = T;
+	using Key = std::make_unsigned_t<T>;
+	using Low = std::uint16_t;
+	using Word = std::uint64_t;
+
+	// Containers with more elements than this are stored as bitmaps.
+	static const constexpr std::size_t ARRAY_MAX = 4096;
+
+	static const constexpr std::size_t BITS = 65536;
+	static const constexpr std::size_t WORDS = BITS / 64;
+
+	/**
+	 * @brief      Maps a value to an unsigned key with the same ordering.
+	 *             Signed values have their sign bit flipped, so that
+	 *             negative values sort before positive ones.
+	 */
+	static inline Key to_key(T v) {
+		Key k = static_cast<Key>(v);
+		if (std::is_signed<T>::value) {
+			k ^= static_cast<Key>(Key(1) << (sizeof(Key) * 8 - 1));
+		}
+		return k;
+	}
+
+	static inline T from_key(Key k) {
+		if (std::is_signed<T>::value) {
+			k ^= static_cast<Key>(Key(1) << (sizeof(Key) * 8 - 1));
+		}
+		return static_cast<T>(k);
+	}
+
+	static inline Key high_of(Key k) {
+		return static_cast<Key>(static_cast<std::uint64_t>(k) >> 16);
+	}
+
+	static inline Low low_of(Key k) {
+		return static_cast<Low>(k & 0xFFFF);
+	}
+
+	static inline Key compose(Key high, std::size_t low) {
+		return static_cast<Key>((static_cast<std::uint64_t>(high) << 16) | low);
+	}
+
+	static inline std::size_t popcount(Word w) {
+		return __builtin_popcountll(w);
+	}
+
+	/**
+	 * @brief      All the values of the set that share one high part.
+	 *             Exactly one of `array` and `words` is in use: `words` is
+	 *             empty for array containers.
+	 */
+	struct Container {
+		Key high = 0;
+		std::size_t cardinality = 0;
+		std::vector<Low> array = {};
+		std::vector<Word> words = {};
+
+		inline bool is_bitmap() const {
+			return !words.empty();
+		}
+
+		inline bool contains(Low v) const {
+			if (is_bitmap()) {
+				return (words[v >> 6] >> (v & 63)) & 1;
+			}
+			return std::binary_search(array.begin(), array.end(), v);
+		}
+
+		void to_bitmap() {
+			words.assign(WORDS, 0);
+			for (Low v : array) {
+				words[v >> 6] |= Word(1) << (v & 63);
+			}
+			array.clear();
+			array.shrink_to_fit();
+		}
+
+		void to_array() {
+			array.clear();
+			array.reserve(cardinality);
+			for (std::size_t i = 0; i < WORDS; i++) {
+				Word w = words[i];
+				while (w) {
+					array.push_back(static_cast<Low>(i * 64 + __builtin_ctzll(w)));
+					w &= w - 1;
+				}
+			}
+			words.clear();
+			words.shrink_to_fit();
+		}
+
+		/**
+		 * @brief      Picks the cheaper representation for the current
+		 *             cardinality.
+		 */
+		void normalize() {
+			if (is_bitmap() && cardinality <= ARRAY_MAX) {
+				to_array();
+			} else if (!is_bitmap() && cardinality > ARRAY_MAX) {
+				to_bitmap();
+			}
+		}
+
+		bool add(Low v) {
+			if (is_bitmap()) {
+				Word &w = words[v >> 6];
+				Word bit = Word(1) << (v & 63);
+				if (w & bit) {
+					return false;
+				}
+				w |= bit;
+				cardinality++;
+				return true;
+			}
+
+			auto pos = std::lower_bound(array.begin(), array.end(), v);
+			if (pos != array.end() && *pos == v) {
+				return false;
+			}
+			array.insert(pos, v);
+			cardinality++;
+			normalize();
+			return true;
+		}
+
+		bool remove(Low v) {
+			if (is_bitmap()) {
+				Word &w = words[v >> 6];
+				Word bit = Word(1) << (v & 63);
+				if (!(w & bit)) {
+					return false;
+				}
+				w &= ~bit;
+				cardinality--;
+				normalize();
+				return true;
+			}
+
+			auto pos = std::lower_bound(array.begin(), array.end(), v);
+			if (pos == array.end() || *pos != v) {
+				return false;
+			}
+			array.erase(pos);
+			cardinality--;
+			return true;
+		}
+
+		/**
+		 * @brief      Returns the position of the first set bit at or after
+		 *             `from`, or BITS if there is none. Bitmap containers only.
+		 */
+		inline std::size_t next_bit(std::size_t from) const {
+			std::size_t i = from >> 6;
+			if (i >= WORDS) {
+				return BITS;
+			}
+
+			Word w = words[i] & (~Word(0) << (from & 63));
+			while (w == 0) {
+				if (++i == WORDS) {
+					return BITS;
+				}
+				w = words[i];
+			}
+
+			return i * 64 + __builtin_ctzll(w);
+		}
+
+		bool operator==(const Container &c) const {
+			return high == c.high &&
+				cardinality == c.cardinality &&
+				array == c.array &&
+				words == c.words;
+		}
+
+		// Container-level kernels. Each pair of representations is handled
+		// separately; bitmap pairs work a whole word at a time.
+
+		static Container unite(const Container &a, const Container &b) {
+			Container r;
+			r.high = a.high;
+
+			if (!a.is_bitmap() && !b.is_bitmap()) {
+				r.array.reserve(a.array.size() + b.array.size());
+				std::set_union(
+					a.array.begin(), a.array.end(),
+					b.array.begin(), b.array.end(),
+					std::back_inserter(r.array));
+				r.cardinality = r.array.size();
+				r.normalize();
+				return r;
+			}
+
+			const Container &dense = a.is_bitmap() ? a : b;
+			const Container &other = a.is_bitmap() ? b : a;
+
+			r.words = dense.words;
+			if (other.is_bitmap()) {
+				std::size_t card = 0;
+				for (std::size_t i = 0; i < WORDS; i++) {
+					r.words[i] |= other.words[i];
+					card += popcount(r.words[i]);
+				}
+				r.cardinality = card;
+			} else {
+				r.cardinality = dense.cardinality;
+				for (Low v : other.array) {
+					Word &w = r.words[v >> 6];
+					Word bit = Word(1) << (v & 63);
+					r.cardinality += !(w & bit);
+					w |= bit;
+				}
+			}
+
+			return r;
+		}
+
+		static Container intersect(const Container &a, const Container &b) {
+			Container r;
+			r.high = a.high;
+
+			if (!a.is_bitmap() && !b.is_bitmap()) {
+				std::set_intersection(
+					a.array.begin(), a.array.end(),
+					b.array.begin(), b.array.end(),
+					std::back_inserter(r.array));
+				r.cardinality = r.array.size();
+				return r;
+			}
+
+			if (a.is_bitmap() && b.is_bitmap()) {
+				r.words.resize(WORDS);
+				std::size_t card = 0;
+				for (std::size_t i = 0; i < WORDS; i++) {
+					r.words[i] = a.words[i] & b.words[i];
+					card += popcount(r.words[i]);
+				}
+				r.cardinality = card;
+				r.normalize();
+				return r;
+			}
+
+			const Container &dense = a.is_bitmap() ? a : b;
+			const Container &sparse = a.is_bitmap() ? b : a;
+
+			for (Low v : sparse.array) {
+				if (dense.contains(v)) {
+					r.array.push_back(v);
+				}
+			}
+			r.cardinality = r.array.size();
+			return r;
+		}
+
+		static Container subtract(const Container &a, const Container &b) {
+			Container r;
+			r.high = a.high;
+
+			if (!a.is_bitmap()) {
+				if (b.is_bitmap()) {
+					for (Low v : a.array) {
+						if (!b.contains(v)) {
+							r.array.push_back(v);
+						}
+					}
+				} else {
+					std::set_difference(
+						a.array.begin(), a.array.end(),
+						b.array.begin(), b.array.end(),
+						std::back_inserter(r.array));
+				}
+				r.cardinality = r.array.size();
+				return r;
+			}
+
+			r.words = a.words;
+			if (b.is_bitmap()) {
+				std::size_t card = 0;
+				for (std::size_t i = 0; i < WORDS; i++) {
+					r.words[i] &= ~b.words[i];
+					card += popcount(r.words[i]);
+				}
+				r.cardinality = card;
+			} else {
+				r.cardinality = a.cardinality;
+				for (Low v : b.array) {
+					Word &w = r.words[v >> 6];
+					Word bit = Word(1) << (v & 63);
+					r.cardinality -= (w & bit) != 0;
+					w &= ~bit;
+				}
+			}
+
+			r.normalize();
+			return r;
+		}
+
+		/**
+		 * @brief      Determines whether every value of `a` is also in `b`.
+		 */
+		static bool contained_in(const Container &a, const Container &b) {
+			if (a.cardinality > b.cardinality) {
+				return false;
+			}
+
+			if (a.is_bitmap() && b.is_bitmap()) {
+				for (std::size_t i = 0; i < WORDS; i++) {
+					if (a.words[i] & ~b.words[i]) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			if (!a.is_bitmap() && !b.is_bitmap()) {
+				return std::includes(
+					b.array.begin(), b.array.end(),
+					a.array.begin(), a.array.end());
+			}
+
+			if (!a.is_bitmap()) {
+				for (Low v : a.array) {
+					if (!b.contains(v)) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			for (std::size_t i = 0; i < WORDS; i++) {
+				for (Word w = a.words[i]; w; w &= w - 1) {
+					if (!b.contains(static_cast<Low>(i * 64 + __builtin_ctzll(w)))) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+	};
+
+	// Containers, sorted by their high part. Empty containers are never kept.
+	std::vector<Container> containers = {};
+	std::size_t cardinality = 0;
+
+	Bitmap() = default;
+
+	Bitmap(std::initializer_list<T> values) {
+		for (T v : values) {
+			insert(v);
+		}
+	}
+
+	template<typename Iterator>
+	Bitmap(Iterator begin, Iterator end) {
+		insert(begin, end);
+	}
+
+	inline std::size_t size() const {
+		return cardinality;
+	}
+
+	inline bool empty() const {
+		return cardinality == 0;
+	}
+
+	/**
+	 * @brief      Returns the heap memory held by the containers.
+	 */
+	std::size_t memory_usage() const {
+		std::size_t bytes = containers.capacity() * sizeof(Container);
+		for (const Container &c : containers) {
+			bytes += c.array.capacity() * sizeof(Low) + c.words.capacity() * sizeof(Word);
+		}
+		return bytes;
+	}
+
+	/**
+	 * @brief      Finds the container for a high part.
+	 *
+	 * @return     The position of the container, or the position where it
+	 *             would be inserted.
+	 */
+	inline typename std::vector<Container>::const_iterator find_container(Key high) const {
+		// Values are commonly added in ascending order.
+		if (!containers.empty() && containers.back().high == high) {
+			return containers.end() - 1;
+		}
+
+		return std::lower_bound(
+			containers.begin(), containers.end(), high,
+			[](const Container &c, Key h) { return c.high < h; });
+	}
+
+	inline std::size_t count(T v) const {
+		Key k = to_key(v);
+		auto c = find_container(high_of(k));
+		return c != containers.end() && c->high == high_of(k) && c->contains(low_of(k));
+	}
+
+	bool insert(T v) {
+		Key k = to_key(v);
+		Key high = high_of(k);
+		auto pos = containers.begin() + (find_container(high) - containers.cbegin());
+
+		if (pos == containers.end() || pos->high != high) {
+			pos = containers.insert(pos, Container());
+			pos->high = high;
+		}
+
+		bool added = pos->add(low_of(k));
+		cardinality += added;
+		return added;
+	}
+
+	template<typename Iterator>
+	void insert(Iterator begin, Iterator end) {
+		for (; begin != end; begin++) {
+			insert(*begin);
+		}
+	}
+
+	std::size_t erase(T v) {
+		Key k = to_key(v);
+		Key high = high_of(k);
+		auto pos = containers.begin() + (find_container(high) - containers.cbegin());
+
+		if (pos == containers.end() || pos->high != high || !pos->remove(low_of(k))) {
+			return 0;
+		}
+
+		if (pos->cardinality == 0) {
+			containers.erase(pos);
+		}
+
+		cardinality--;
+		return 1;
+	}
+
+	bool operator==(const Bitmap &b) const {
+		return cardinality == b.cardinality && containers == b.containers;
+	}
+
+	bool operator!=(const Bitmap &b) const {
+		return !(*this == b);
+	}
+
+	inline void push_container(Container &&c) {
+		if (c.cardinality > 0) {
+			cardinality += c.cardinality;
+			containers.push_back(std::move(c));
+		}
+	}
+
+	static Bitmap set_union(const Bitmap &a, const Bitmap &b) {
+		Bitmap r;
+		r.containers.reserve(a.containers.size() + b.containers.size());
+
+		auto i = a.containers.begin();
+		auto j = b.containers.begin();
+
+		while (i != a.containers.end() && j != b.containers.end()) {
+			if (i->high < j->high) {
+				r.push_container(Container(*i++));
+			} else if (j->high < i->high) {
+				r.push_container(Container(*j++));
+			} else {
+				r.push_container(Container::unite(*i++, *j++));
+			}
+		}
+
+		for (; i != a.containers.end(); i++) {
+			r.push_container(Container(*i));
+		}
+
+		for (; j != b.containers.end(); j++) {
+			r.push_container(Container(*j));
+		}
+
+		return r;
+	}
+
+	static Bitmap set_intersection(const Bitmap &a, const Bitmap &b) {
+		Bitmap r;
+
+		auto i = a.containers.begin();
+		auto j = b.containers.begin();
+
+		while (i != a.containers.end() && j != b.containers.end()) {
+			if (i->high < j->high) {
+				i++;
+			} else if (j->high < i->high) {
+				j++;
+			} else {
+				r.push_container(Container::intersect(*i++, *j++));
+			}
+		}
+
+		return r;
+	}
+
+	static Bitmap set_difference(const Bitmap &a, const Bitmap &b) {
+		Bitmap r;
+		r.containers.reserve(a.containers.size());
+
+		auto j = b.containers.begin();
+
+		for (const Container &c : a.containers) {
+			while (j != b.containers.end() && j->high < c.high) {
+				j++;
+			}
+
+			if (j != b.containers.end() && j->high == c.high) {
+				r.push_container(Container::subtract(c, *j));
+			} else {
+				r.push_container(Container(c));
+			}
+		}
+
+		return r;
+	}
+
+	/**
+	 * @brief      Determines whether every value of `a` is also in `b`, one
+	 *             container pair at a time.
+	 */
+	static bool is_subset(const Bitmap &a, const Bitmap &b) {
+		if (a.cardinality > b.cardinality) {
+			return false;
+		}
+
+		auto j = b.containers.begin();
+
+		for (const Container &c : a.containers) {
+			while (j != b.containers.end() && j->high < c.high) {
+				j++;
+			}
+
+			if (j == b.containers.end() || j->high != c.high ||
+				!Container::contained_in(c, *j)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief      Forward iterator over the values, in ascending order.
+	 *             Values are produced on the fly, so dereferencing yields a
+	 *             value rather than a reference.
+	 */
+	struct const_iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T *;
+		using reference = T;
+
+		const Bitmap *bitmap = nullptr;
+		std::size_t container = 0;
+
+		// Array index for array containers, bit position for bitmaps.
+		std::size_t pos = 0;
+
+		inline void seek_container() {
+			if (container < bitmap->containers.size()) {
+				const Container &c = bitmap->containers[container];
+				pos = c.is_bitmap() ? c.next_bit(0) : 0;
+			} else {
+				pos = 0;
+			}
+		}
+
+		inline T operator*() const {
+			const Container &c = bitmap->containers[container];
+			return from_key(compose(c.high, c.is_bitmap() ? pos : c.array[pos]));
+		}
+
+		inline const_iterator &operator++() {
+			const Container &c = bitmap->containers[container];
+
+			if (c.is_bitmap()) {
+				pos = c.next_bit(pos + 1);
+				if (pos < BITS) {
+					return *this;
+				}
+			} else if (++pos < c.array.size()) {
+				return *this;
+			}
+
+			container++;
+			seek_container();
+			return *this;
+		}
+
+		inline const_iterator operator++(int) {
+			const_iterator ret = *this;
+			++(*this);
+			return ret;
+		}
+
+		inline bool operator==(const const_iterator &i) const {
+			return container == i.container && pos == i.pos;
+		}
+
+		inline bool operator!=(const const_iterator &i) const {
+			return !(*this == i);
+		}
+	};
+
+	using iterator = const_iterator;
+
+	const_iterator begin() const {
+		const_iterator i;
+		i.bitmap = this;
+		i.container = 0;
+		i.seek_container();
+		return i;
+	}
+
+	const_iterator end() const {
+		const_iterator i;
+		i.bitmap = this;
+		i.container = containers.size();
+		i.pos = 0;
+		return i;
+	}
+};
+
+}
+
+#endif
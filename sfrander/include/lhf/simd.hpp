@@ -0,0 +1,724 @@
+#ifndef LHF_SIMD_HPP
+#define LHF_SIMD_HPP
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "lhf_config.hpp"
+
+#if !defined(LHF_DISABLE_SIMD) && \
+	(defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define LHF_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace lhf {
+
+/**
+ * @brief      Merge kernels for sets stored as sorted, duplicate-free arrays.
+ *
+ *             Every kernel reads two sorted runs `a` and `b`, writes the
+ *             result to `out` and returns the number of elements written.
+ *             `out` must have room for `na + nb` elements for unions and
+ *             `na` elements for intersections and differences.
+ *
+ *             The scalar kernels work for any element type. For the element
+ *             types used by the points-to graphs (32-bit and 64-bit integers
+ *             with the default comparators) SortedSetKernels picks a vector
+ *             implementation at runtime, depending on what the CPU supports.
+ */
+namespace simd {
+
+template<typename T, typename Less>
+std::size_t scalar_union(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+	Less less;
+	std::size_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (less(b[j], a[i])) {
+			out[k++] = b[j++];
+		} else {
+			if (!less(a[i], b[j])) {
+				j++;
+			}
+			out[k++] = a[i++];
+		}
+	}
+
+	while (i < na) {
+		out[k++] = a[i++];
+	}
+
+	while (j < nb) {
+		out[k++] = b[j++];
+	}
+
+	return k;
+}
+
+template<typename T, typename Less>
+std::size_t scalar_intersection(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+	Less less;
+	std::size_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (less(a[i], b[j])) {
+			i++;
+		} else {
+			if (!less(b[j], a[i])) {
+				out[k++] = a[i++];
+			}
+			j++;
+		}
+	}
+
+	return k;
+}
+
+template<typename T, typename Less>
+std::size_t scalar_difference(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+	Less less;
+	std::size_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (less(a[i], b[j])) {
+			out[k++] = a[i++];
+		} else {
+			if (!less(b[j], a[i])) {
+				i++;
+			}
+			j++;
+		}
+	}
+
+	while (i < na) {
+		out[k++] = a[i++];
+	}
+
+	return k;
+}
+
+/**
+ * @brief      Exponential (galloping) search. Finds the first position in
+ *             [lo, n) whose element is not less than `v`, probing lo, lo + 1,
+ *             lo + 3, lo + 7, ... before binary searching the last step.
+ *             This costs O(log d) for a match d positions ahead.
+ */
+template<typename T, typename Less>
+inline std::size_t gallop(const T *a, std::size_t lo, std::size_t n, const T &v) {
+	Less less;
+	std::size_t hi = lo;
+	std::size_t step = 1;
+
+	while (hi < n && less(a[hi], v)) {
+		lo = hi + 1;
+		hi += step;
+		step <<= 1;
+	}
+
+	if (hi > n) {
+		hi = n;
+	}
+
+	return std::lower_bound(a + lo, a + hi, v, less) - a;
+}
+
+/**
+ * @brief      Intersection for operands of very different sizes: each
+ *             element of the small run is galloped for in the large one.
+ *             `out` needs room for `n_small` elements.
+ */
+template<typename T, typename Less>
+std::size_t gallop_intersection(
+	const T *small, std::size_t n_small,
+	const T *large, std::size_t n_large,
+	T *out) {
+	Less less;
+	std::size_t j = 0, k = 0;
+
+	for (std::size_t i = 0; i < n_small; i++) {
+		j = gallop<T, Less>(large, j, n_large, small[i]);
+
+		if (j == n_large) {
+			break;
+		}
+
+		if (!less(small[i], large[j])) {
+			out[k++] = small[i];
+			j++;
+		}
+	}
+
+	return k;
+}
+
+/**
+ * @brief      Difference `a \ b` for operands of very different sizes.
+ *             Whichever run is smaller drives the loop, and the larger one
+ *             is galloped through.
+ */
+template<typename T, typename Less>
+std::size_t gallop_difference(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+	Less less;
+	std::size_t k = 0;
+
+	if (na <= nb) {
+		std::size_t j = 0;
+		for (std::size_t i = 0; i < na; i++) {
+			j = gallop<T, Less>(b, j, nb, a[i]);
+
+			if (j < nb && !less(a[i], b[j])) {
+				j++;
+			} else {
+				out[k++] = a[i];
+			}
+		}
+		return k;
+	}
+
+	// Copy the runs of `a` between consecutive elements of `b`.
+	std::size_t i = 0;
+	for (std::size_t j = 0; j < nb && i < na; j++) {
+		std::size_t p = gallop<T, Less>(a, i, na, b[j]);
+		k = std::copy(a + i, a + p, out + k) - out;
+		i = p;
+
+		if (i < na && !less(b[j], a[i])) {
+			i++;
+		}
+	}
+
+	return std::copy(a + i, a + na, out + k) - out;
+}
+
+/**
+ * @brief      Determines whether every element of `a` is also in `b`, by
+ *             merging. Stops at the first element of `a` that is missing.
+ */
+template<typename T, typename Less>
+bool scalar_subset(const T *a, std::size_t na, const T *b, std::size_t nb) {
+	Less less;
+	std::size_t j = 0;
+
+	for (std::size_t i = 0; i < na; i++) {
+		while (j < nb && less(b[j], a[i])) {
+			j++;
+		}
+
+		if (j == nb || less(a[i], b[j])) {
+			return false;
+		}
+		j++;
+	}
+
+	return true;
+}
+
+/**
+ * @brief      Like scalar_subset, but gallops through `b`. Use this when `b`
+ *             is much larger than `a`.
+ */
+template<typename T, typename Less>
+bool gallop_subset(const T *a, std::size_t na, const T *b, std::size_t nb) {
+	Less less;
+	std::size_t j = 0;
+
+	for (std::size_t i = 0; i < na; i++) {
+		j = gallop<T, Less>(b, j, nb, a[i]);
+
+		if (j == nb || less(a[i], b[j])) {
+			return false;
+		}
+		j++;
+	}
+
+	return true;
+}
+
+/**
+ * @brief      Finishes a vector union: merges the values still held in the
+ *             merge register (`pending`) with the unconsumed tails of both
+ *             inputs, dropping anything equal to the last value written.
+ */
+template<typename T>
+std::size_t union_tail(
+	const T *pending, std::size_t np,
+	const T *a, std::size_t na,
+	const T *b, std::size_t nb,
+	T *out, std::size_t k) {
+	std::size_t p = 0, i = 0, j = 0;
+
+	while (p < np || i < na || j < nb) {
+		const T *next = nullptr;
+
+		if (p < np) {
+			next = &pending[p];
+		}
+		if (i < na && (next == nullptr || a[i] < *next)) {
+			next = &a[i];
+		}
+		if (j < nb && (next == nullptr || b[j] < *next)) {
+			next = &b[j];
+		}
+
+		if (next == &pending[p]) {
+			p++;
+		} else if (next == &a[i]) {
+			i++;
+		} else {
+			j++;
+		}
+
+		if (k == 0 || out[k - 1] != *next) {
+			out[k++] = *next;
+		}
+	}
+
+	return k;
+}
+
+#ifdef LHF_SIMD_X86
+
+struct CpuFeatures {
+	bool sse41 = false;
+	bool avx2 = false;
+
+	static const CpuFeatures &get() {
+		static const CpuFeatures features = []() {
+			CpuFeatures f;
+			__builtin_cpu_init();
+			f.sse41 = __builtin_cpu_supports("sse4.1");
+			f.avx2 = __builtin_cpu_supports("avx2");
+			return f;
+		}();
+		return features;
+	}
+};
+
+/**
+ * @brief      Shuffle tables that move the lanes selected by a 4-bit mask to
+ *             the front of a vector, keeping their order.
+ */
+struct CompactTables {
+	// pshufb control bytes for four 32-bit lanes.
+	alignas(16) std::uint8_t epi32[16][16];
+
+	// vpermd indices for four 64-bit lanes.
+	alignas(32) std::uint32_t epi64[16][8];
+
+	CompactTables() {
+		for (int mask = 0; mask < 16; mask++) {
+			int n = 0;
+			for (int lane = 0; lane < 4; lane++) {
+				if (mask & (1 << lane)) {
+					for (int byte = 0; byte < 4; byte++) {
+						epi32[mask][n * 4 + byte] = lane * 4 + byte;
+					}
+					epi64[mask][n * 2] = lane * 2;
+					epi64[mask][n * 2 + 1] = lane * 2 + 1;
+					n++;
+				}
+			}
+			for (; n < 4; n++) {
+				for (int byte = 0; byte < 4; byte++) {
+					epi32[mask][n * 4 + byte] = 0x80;
+				}
+				epi64[mask][n * 2] = 0;
+				epi64[mask][n * 2 + 1] = 0;
+			}
+		}
+	}
+
+	static const CompactTables &get() {
+		static const CompactTables tables;
+		return tables;
+	}
+};
+
+// 32-bit kernels (SSE4.1). Four lanes per block.
+
+__attribute__((target("sse4.1")))
+inline int match_mask_u32(__m128i va, __m128i vb) {
+	__m128i m = _mm_cmpeq_epi32(va, vb);
+	vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm_or_si128(m, _mm_cmpeq_epi32(va, vb));
+	vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm_or_si128(m, _mm_cmpeq_epi32(va, vb));
+	vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm_or_si128(m, _mm_cmpeq_epi32(va, vb));
+	return _mm_movemask_ps(_mm_castsi128_ps(m));
+}
+
+__attribute__((target("sse4.1")))
+inline std::size_t store_lanes_u32(const CompactTables &t, std::uint32_t *out, __m128i v, int keep) {
+	__m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i *>(t.epi32[keep]));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(v, shuffle));
+	return __builtin_popcount(keep);
+}
+
+/**
+ * @brief      Block-wise intersection or difference: each block of four `a`
+ *             values is compared against every block of `b` that overlaps
+ *             it, and the block is written out (keeping matched lanes for an
+ *             intersection, unmatched ones for a difference) once no later
+ *             `b` block can match it.
+ *
+ *             The output is written four lanes at a time, so `out` must not
+ *             alias `a` and needs room for `na` elements.
+ */
+template<bool keep_matched>
+__attribute__((target("sse4.1")))
+std::size_t sse41_filter_u32(
+	const std::uint32_t *a, std::size_t na,
+	const std::uint32_t *b, std::size_t nb,
+	std::uint32_t *out) {
+	const CompactTables &t = CompactTables::get();
+	std::size_t i = 0, j = 0, k = 0;
+
+	// `b` position when the current `a` block was loaded. Everything before
+	// it is smaller than the block.
+	std::size_t j_mark = 0;
+	int matched = 0;
+
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+		matched |= match_mask_u32(va, vb);
+
+		const std::uint32_t a_max = a[i + 3];
+		const std::uint32_t b_max = b[j + 3];
+
+		if (b_max <= a_max) {
+			j += 4;
+		}
+
+		if (a_max <= b_max) {
+			k += store_lanes_u32(t, out + k, va, keep_matched ? matched : (~matched & 0xF));
+			i += 4;
+			j_mark = j;
+			matched = 0;
+		}
+	}
+
+	if (keep_matched) {
+		return k + scalar_intersection<std::uint32_t, std::less<std::uint32_t>>(
+			a + i, na - i, b + j_mark, nb - j_mark, out + k);
+	} else {
+		return k + scalar_difference<std::uint32_t, std::less<std::uint32_t>>(
+			a + i, na - i, b + j_mark, nb - j_mark, out + k);
+	}
+}
+
+/**
+ * @brief      Merges two sorted vectors of four lanes. `lo` receives the four
+ *             smallest values and `hi` the four largest, both sorted.
+ */
+__attribute__((target("sse4.1")))
+inline void merge_network_u32(__m128i a, __m128i b, __m128i &lo, __m128i &hi) {
+	__m128i tmp = _mm_min_epu32(a, b);
+	hi = _mm_max_epu32(a, b);
+	tmp = _mm_alignr_epi8(tmp, tmp, 4);
+	lo = _mm_min_epu32(tmp, hi);
+	hi = _mm_max_epu32(tmp, hi);
+	tmp = _mm_alignr_epi8(lo, lo, 4);
+	lo = _mm_min_epu32(tmp, hi);
+	hi = _mm_max_epu32(tmp, hi);
+	tmp = _mm_alignr_epi8(lo, lo, 4);
+	lo = _mm_min_epu32(tmp, hi);
+	hi = _mm_max_epu32(tmp, hi);
+	lo = _mm_alignr_epi8(lo, lo, 4);
+}
+
+__attribute__((target("sse4.1")))
+inline std::size_t sse41_union_u32(
+	const std::uint32_t *a, std::size_t na,
+	const std::uint32_t *b, std::size_t nb,
+	std::uint32_t *out) {
+	if (na < 4 || nb < 4) {
+		return scalar_union<std::uint32_t, std::less<std::uint32_t>>(a, na, b, nb, out);
+	}
+
+	const CompactTables &t = CompactTables::get();
+	std::size_t i = 4, j = 4, k = 0;
+	__m128i lo, hi;
+	merge_network_u32(
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)),
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)),
+		lo, hi);
+
+	// Last lane of `prev` is the value written before `lo`. For the first
+	// block it is made to differ from the first lane.
+	__m128i prev = _mm_set1_epi32(~_mm_cvtsi128_si32(lo));
+
+	for (;;) {
+		// Drop lanes equal to their predecessor in the merged stream.
+		__m128i shifted = _mm_alignr_epi8(lo, prev, 12);
+		int dup = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, shifted)));
+		k += store_lanes_u32(t, out + k, lo, ~dup & 0xF);
+		prev = lo;
+
+		const std::uint32_t *next;
+		if (i < na && (j >= nb || a[i] <= b[j])) {
+			if (i + 4 > na) {
+				break;
+			}
+			next = a + i;
+			i += 4;
+		} else {
+			if (j + 4 > nb) {
+				break;
+			}
+			next = b + j;
+			j += 4;
+		}
+
+		merge_network_u32(
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(next)), hi, lo, hi);
+	}
+
+	alignas(16) std::uint32_t pending[4];
+	_mm_store_si128(reinterpret_cast<__m128i *>(pending), hi);
+	return union_tail<std::uint32_t>(pending, 4, a + i, na - i, b + j, nb - j, out, k);
+}
+
+// 64-bit kernels (AVX2). Four lanes per block.
+
+__attribute__((target("avx2")))
+inline int match_mask_i64(__m256i va, __m256i vb) {
+	__m256i m = _mm256_cmpeq_epi64(va, vb);
+	vb = _mm256_permute4x64_epi64(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+	vb = _mm256_permute4x64_epi64(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+	vb = _mm256_permute4x64_epi64(vb, _MM_SHUFFLE(0, 3, 2, 1));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, vb));
+	return _mm256_movemask_pd(_mm256_castsi256_pd(m));
+}
+
+__attribute__((target("avx2")))
+inline std::size_t store_lanes_i64(const CompactTables &t, std::int64_t *out, __m256i v, int keep) {
+	__m256i perm = _mm256_load_si256(reinterpret_cast<const __m256i *>(t.epi64[keep]));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permutevar8x32_epi32(v, perm));
+	return __builtin_popcount(keep);
+}
+
+template<bool keep_matched>
+__attribute__((target("avx2")))
+std::size_t avx2_filter_i64(
+	const std::int64_t *a, std::size_t na,
+	const std::int64_t *b, std::size_t nb,
+	std::int64_t *out) {
+	const CompactTables &t = CompactTables::get();
+	std::size_t i = 0, j = 0, k = 0;
+	std::size_t j_mark = 0;
+	int matched = 0;
+
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+		matched |= match_mask_i64(va, vb);
+
+		const std::int64_t a_max = a[i + 3];
+		const std::int64_t b_max = b[j + 3];
+
+		if (b_max <= a_max) {
+			j += 4;
+		}
+
+		if (a_max <= b_max) {
+			k += store_lanes_i64(t, out + k, va, keep_matched ? matched : (~matched & 0xF));
+			i += 4;
+			j_mark = j;
+			matched = 0;
+		}
+	}
+
+	if (keep_matched) {
+		return k + scalar_intersection<std::int64_t, std::less<std::int64_t>>(
+			a + i, na - i, b + j_mark, nb - j_mark, out + k);
+	} else {
+		return k + scalar_difference<std::int64_t, std::less<std::int64_t>>(
+			a + i, na - i, b + j_mark, nb - j_mark, out + k);
+	}
+}
+
+__attribute__((target("avx2")))
+inline void minmax_i64(__m256i a, __m256i b, __m256i &lo, __m256i &hi) {
+	__m256i gt = _mm256_cmpgt_epi64(a, b);
+	lo = _mm256_blendv_epi8(a, b, gt);
+	hi = _mm256_blendv_epi8(b, a, gt);
+}
+
+__attribute__((target("avx2")))
+inline void merge_network_i64(__m256i a, __m256i b, __m256i &lo, __m256i &hi) {
+	__m256i tmp;
+	minmax_i64(a, b, tmp, hi);
+	tmp = _mm256_permute4x64_epi64(tmp, _MM_SHUFFLE(0, 3, 2, 1));
+	minmax_i64(tmp, hi, lo, hi);
+	tmp = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(0, 3, 2, 1));
+	minmax_i64(tmp, hi, lo, hi);
+	tmp = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(0, 3, 2, 1));
+	minmax_i64(tmp, hi, lo, hi);
+	lo = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+__attribute__((target("avx2")))
+inline std::size_t avx2_union_i64(
+	const std::int64_t *a, std::size_t na,
+	const std::int64_t *b, std::size_t nb,
+	std::int64_t *out) {
+	if (na < 4 || nb < 4) {
+		return scalar_union<std::int64_t, std::less<std::int64_t>>(a, na, b, nb, out);
+	}
+
+	const CompactTables &t = CompactTables::get();
+	std::size_t i = 4, j = 4, k = 0;
+	__m256i lo, hi;
+	merge_network_i64(
+		_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)),
+		_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)),
+		lo, hi);
+
+	__m256i prev = _mm256_set1_epi64x(~_mm256_extract_epi64(lo, 0));
+
+	for (;;) {
+		// [prev3, lo0, lo1, lo2], compared lane-wise against `lo`.
+		__m256i shifted = _mm256_blend_epi32(
+			_mm256_permute4x64_epi64(lo, _MM_SHUFFLE(2, 1, 0, 3)),
+			_mm256_permute4x64_epi64(prev, _MM_SHUFFLE(2, 1, 0, 3)),
+			0x03);
+		int dup = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, shifted)));
+		k += store_lanes_i64(t, out + k, lo, ~dup & 0xF);
+		prev = lo;
+
+		const std::int64_t *next;
+		if (i < na && (j >= nb || a[i] <= b[j])) {
+			if (i + 4 > na) {
+				break;
+			}
+			next = a + i;
+			i += 4;
+		} else {
+			if (j + 4 > nb) {
+				break;
+			}
+			next = b + j;
+			j += 4;
+		}
+
+		merge_network_i64(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i *>(next)), hi, lo, hi);
+	}
+
+	alignas(32) std::int64_t pending[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(pending), hi);
+	return union_tail<std::int64_t>(pending, 4, a + i, na - i, b + j, nb - j, out, k);
+}
+
+#endif
+
+/**
+ * @brief      Selects merge kernels for sorted arrays of `T` ordered by
+ *             `Less`. The generic version always uses the scalar kernels.
+ */
+template<typename T, typename Less>
+struct SortedSetKernels {
+	static inline std::size_t set_union(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return scalar_union<T, Less>(a, na, b, nb, out);
+	}
+
+	static inline std::size_t set_intersection(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return scalar_intersection<T, Less>(a, na, b, nb, out);
+	}
+
+	static inline std::size_t set_difference(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return scalar_difference<T, Less>(a, na, b, nb, out);
+	}
+};
+
+#ifdef LHF_SIMD_X86
+
+/**
+ * @brief      Runtime-dispatched kernels for an integer type whose values
+ *             are laid out like `LaneT`. The kernel is picked once, on first
+ *             use.
+ */
+template<typename T, typename LaneT>
+struct DispatchedKernels {
+	static_assert(sizeof(T) == sizeof(LaneT), "Lane type must match the element type");
+
+	using Kernel = std::size_t (*)(const LaneT *, std::size_t, const LaneT *, std::size_t, LaneT *);
+
+	struct Table {
+		Kernel set_union;
+		Kernel set_intersection;
+		Kernel set_difference;
+	};
+
+	static Table select();
+
+	static inline const Table &table() {
+		static const Table t = select();
+		return t;
+	}
+
+	static inline const LaneT *lanes(const T *p) {
+		return reinterpret_cast<const LaneT *>(p);
+	}
+
+	static inline std::size_t set_union(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return table().set_union(lanes(a), na, lanes(b), nb, reinterpret_cast<LaneT *>(out));
+	}
+
+	static inline std::size_t set_intersection(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return table().set_intersection(lanes(a), na, lanes(b), nb, reinterpret_cast<LaneT *>(out));
+	}
+
+	static inline std::size_t set_difference(const T *a, std::size_t na, const T *b, std::size_t nb, T *out) {
+		return table().set_difference(lanes(a), na, lanes(b), nb, reinterpret_cast<LaneT *>(out));
+	}
+};
+
+template<>
+inline DispatchedKernels<unsigned int, std::uint32_t>::Table
+DispatchedKernels<unsigned int, std::uint32_t>::select() {
+	using Less = std::less<std::uint32_t>;
+	if (CpuFeatures::get().sse41) {
+		return {sse41_union_u32, sse41_filter_u32<true>, sse41_filter_u32<false>};
+	}
+	return {
+		scalar_union<std::uint32_t, Less>,
+		scalar_intersection<std::uint32_t, Less>,
+		scalar_difference<std::uint32_t, Less>};
+}
+
+template<>
+inline DispatchedKernels<long long, std::int64_t>::Table
+DispatchedKernels<long long, std::int64_t>::select() {
+	using Less = std::less<std::int64_t>;
+	if (CpuFeatures::get().avx2) {
+		return {avx2_union_i64, avx2_filter_i64<true>, avx2_filter_i64<false>};
+	}
+	return {
+		scalar_union<std::int64_t, Less>,
+		scalar_intersection<std::int64_t, Less>,
+		scalar_difference<std::int64_t, Less>};
+}
+
+template<>
+struct SortedSetKernels<unsigned int, std::less<unsigned int>>:
+	DispatchedKernels<unsigned int, std::uint32_t> {};
+
+template<>
+struct SortedSetKernels<long long, std::less<long long>>:
+	DispatchedKernels<long long, std::int64_t> {};
+
+#endif
+
+}
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef LHF_JSON_HPP
+#define LHF_JSON_HPP
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace lhf {
+
+/**
+ * @brief      Writes a JSON document made of nested objects, laid out like
+ *             the statistics files of the benchmarks (`stats/<name>.stats.json`):
+ *             one member per line, indented by four spaces per level.
+ *
+ *             Members are written with value() into the innermost object
+ *             opened with begin_object(). The document itself is the
+ *             outermost object.
+ */
+class JsonWriter {
+	std::stringstream s;
+
+	// For each open object, whether it has members yet.
+	std::vector<bool> has_members;
+
+	void member(const std::string &key) {
+		if (!has_members.empty()) {
+			if (has_members.back()) {
+				s << ",";
+			}
+			has_members.back() = true;
+			s << "\n" << std::string(4 * has_members.size(), ' ');
+		}
+
+		if (!key.empty()) {
+			s << quote(key) << ": ";
+		}
+	}
+
+public:
+	JsonWriter() {
+		s.precision(std::numeric_limits<double>::max_digits10);
+	}
+
+	static std::string quote(const std::string &str) {
+		std::string ret = "\"";
+		for (char c : str) {
+			switch (c) {
+				case '"': ret += "\\\""; break;
+				case '\\': ret += "\\\\"; break;
+				case '\n': ret += "\\n"; break;
+				case '\t': ret += "\\t"; break;
+				case '\r': ret += "\\r"; break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20) {
+						char escaped[8];
+						std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+						ret += escaped;
+					} else {
+						ret += c;
+					}
+			}
+		}
+		return ret + "\"";
+	}
+
+	/**
+	 * @brief      Opens an object, as the member `key` of the enclosing
+	 *             object (or as the document, without a key).
+	 */
+	JsonWriter &begin_object(const std::string &key = "") {
+		member(key);
+		s << "{";
+		has_members.push_back(false);
+		return *this;
+	}
+
+	JsonWriter &end_object() {
+		const bool members = has_members.back();
+		has_members.pop_back();
+		if (members) {
+			s << "\n" << std::string(4 * has_members.size(), ' ');
+		}
+		s << "}";
+		return *this;
+	}
+
+	/**
+	 * @brief      Writes a string, boolean or number member. Numbers that
+	 *             are not finite are written as null.
+	 */
+	template<typename T>
+	JsonWriter &value(const std::string &key, const T &v) {
+		member(key);
+		if constexpr (std::is_same_v<T, bool>) {
+			s << (v ? "true" : "false");
+		} else if constexpr (std::is_arithmetic_v<T>) {
+			if constexpr (std::is_floating_point_v<T>) {
+				if (!std::isfinite(v)) {
+					s << "null";
+					return *this;
+				}
+				s << static_cast<double>(v);
+			} else {
+				s << +v;
+			}
+		} else {
+			s << quote(std::string(v));
+		}
+		return *this;
+	}
+
+	std::string str() const {
+		return s.str() + "\n";
+	}
+};
+
+}
+
+#endif
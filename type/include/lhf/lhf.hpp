@@ -1,6 +1,7 @@
 #ifndef LHF_HPP
 #define LHF_HPP
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <iostream>
 #include <memory>
@@ -15,9 +16,18 @@
 #include <functional>
 #include <algorithm>
 #include <string>
+#include <cstring>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
 
 #include "lhf_config.hpp"
 #include "profiling.hpp"
+#include "snapshot.hpp"
+
+#include "bitmap.hpp"
+#include "treap.hpp"
+#include "simd.hpp"
 
 namespace lhf {
 
@@ -49,10 +59,30 @@ using String = std::string;
 
 using Index = std::size_t;
 
+#ifdef LHF_ENABLE_CONCURRENCY
+using Mutex = std::mutex;
+#else
+/**
+ * @brief      Stand-in for std::mutex when concurrency is disabled. Locking
+ *             it compiles away entirely.
+ */
+struct NullMutex {
+	inline void lock() {}
+	inline void unlock() {}
+};
+
+using Mutex = NullMutex;
+#endif
+
+using LockGuard = std::lock_guard<Mutex>;
+
 // The index of the empty set. The first set that will ever be inserted
 // in the property set value storage is the empty set.
 static const constexpr Index EMPTY_SET = 0;
 
+// What compaction maps the index of a dropped set to.
+static const constexpr Index DROPPED_SET = static_cast<Index>(-1);
+
 /**
  * @brief      Converts an iterable container to a string.
  */
@@ -62,7 +92,7 @@ String container_to_string(const SetT &k) {
 
 	s << "{ ";
 
-	for (auto &i : k) {
+	for (const auto &i : k) {
 		s << i << " ";
 	}
 
@@ -90,6 +120,104 @@ String ptr_container_to_string(const PtrSetT &k) {
 	return s.str();
 }
 
+/**
+ * @brief      Estimates the heap memory owned by an object, not counting the
+ *             object itself. Node-based containers are charged for their
+ *             nodes as laid out by libstdc++, so the numbers are estimates
+ *             rather than exact allocator figures. Types that own no heap
+ *             memory (like integers) cost nothing.
+ */
+template<typename T>
+inline std::size_t heap_bytes(const T &) {
+	return 0;
+}
+
+inline std::size_t heap_bytes(const std::string &s);
+
+template<typename A, typename B>
+inline std::size_t heap_bytes(const std::pair<A, B> &p);
+
+template<typename T, typename A>
+inline std::size_t heap_bytes(const std::vector<T, A> &v);
+
+template<typename T, typename C, typename A>
+inline std::size_t heap_bytes(const std::set<T, C, A> &s);
+
+template<typename K, typename V, typename C, typename A>
+inline std::size_t heap_bytes(const std::map<K, V, C, A> &m);
+
+template<typename T, typename H, typename E, typename A>
+inline std::size_t heap_bytes(const std::unordered_set<T, H, E, A> &s);
+
+template<typename K, typename V, typename H, typename E, typename A>
+inline std::size_t heap_bytes(const std::unordered_map<K, V, H, E, A> &m);
+
+// Sums heap_bytes over the elements of a container.
+template<typename ContainerT>
+inline std::size_t element_heap_bytes(const ContainerT &c) {
+	std::size_t bytes = 0;
+	for (const auto &e : c) {
+		bytes += heap_bytes(e);
+	}
+	return bytes;
+}
+
+inline std::size_t heap_bytes(const std::string &s) {
+	// Short strings are stored in the string object itself.
+	static const std::size_t local_capacity = std::string().capacity();
+	return s.capacity() > local_capacity ? s.capacity() + 1 : 0;
+}
+
+template<typename A, typename B>
+inline std::size_t heap_bytes(const std::pair<A, B> &p) {
+	return heap_bytes(p.first) + heap_bytes(p.second);
+}
+
+template<typename T, typename A>
+inline std::size_t heap_bytes(const std::vector<T, A> &v) {
+	return v.capacity() * sizeof(T) + element_heap_bytes(v);
+}
+
+// Red-black tree nodes carry a color and three links.
+static const constexpr std::size_t TREE_NODE_OVERHEAD = 4 * sizeof(void *);
+
+// Hash table nodes carry a link and the cached hash of their key.
+static const constexpr std::size_t HASH_NODE_OVERHEAD = 2 * sizeof(void *);
+
+template<typename T, typename C, typename A>
+inline std::size_t heap_bytes(const std::set<T, C, A> &s) {
+	return s.size() * (sizeof(T) + TREE_NODE_OVERHEAD) + element_heap_bytes(s);
+}
+
+template<typename K, typename V, typename C, typename A>
+inline std::size_t heap_bytes(const std::map<K, V, C, A> &m) {
+	return m.size() * (sizeof(std::pair<const K, V>) + TREE_NODE_OVERHEAD) + element_heap_bytes(m);
+}
+
+template<typename T, typename H, typename E, typename A>
+inline std::size_t heap_bytes(const std::unordered_set<T, H, E, A> &s) {
+	return s.bucket_count() * sizeof(void *) +
+		s.size() * (sizeof(T) + HASH_NODE_OVERHEAD) + element_heap_bytes(s);
+}
+
+template<typename K, typename V, typename H, typename E, typename A>
+inline std::size_t heap_bytes(const std::unordered_map<K, V, H, E, A> &m) {
+	return m.bucket_count() * sizeof(void *) +
+		m.size() * (sizeof(std::pair<const K, V>) + HASH_NODE_OVERHEAD) + element_heap_bytes(m);
+}
+
+template<typename T>
+inline std::size_t heap_bytes(const Bitmap<T> &s) {
+	return s.memory_usage();
+}
+
+// Treap nodes are shared between sets, so they are counted once for the whole
+// node table (see Treap::node_memory_usage) rather than per set.
+template<typename T, typename Less, typename Hash>
+inline std::size_t heap_bytes(const Treap<T, Less, Hash> &) {
+	return 0;
+}
+
 /**
  * @brief      This struct contains the information about the operands of an
  *             operation (union, intersection, etc.)
@@ -167,6 +295,10 @@ struct SetLess {
 
 		return a->size() < b->size();
 	}
+
+	inline bool operator()(const OrderedSetT &a, const OrderedSetT &b) const {
+		return (*this)(&a, &b);
+	}
 };
 
 /**
@@ -175,243 +307,1621 @@ struct SetLess {
  * @tparam     SetT      The set type (like std::set or std::unordered_set)
  * @tparam     ElementT  The element type of the set (the first template param
  *                       of SetT)
+ * @tparam     Backend   The property set backend SetT belongs to (see
+ *                       SortedVectorBackend)
  */
-template<typename SetT, typename ElementT, typename PropertyEqual>
+template<typename SetT, typename ElementT, typename PropertyEqual, typename Backend>
 struct SetEqual {
 	inline bool operator()(const SetT *a, const SetT *b) const {
-		PropertyEqual eq;
-		if (a->size() != b->size()) {
-			return false;
-		}
+		if constexpr (Backend::NATIVE_OPERATIONS) {
+			// Compare whole containers (or, for treaps, roots) rather than
+			// decoding every element.
+			return *a == *b;
+		} else {
+			PropertyEqual eq;
+			if (a->size() != b->size()) {
+				return false;
+			}
 
-		if (a->size() == 0) {
-			return true;
-		}
+			if (a->size() == 0) {
+				return true;
+			}
 
-#ifdef LHF_USE_ORDERED_CONTAINER_FOR_PROPERTY_SETS
-		auto cursor_1 = a->begin();
-		const auto &cursor_end_1 = a->end();
-		auto cursor_2 = b->begin();
+			if constexpr (Backend::ORDERED) {
+				auto cursor_1 = a->begin();
+				const auto &cursor_end_1 = a->end();
+				auto cursor_2 = b->begin();
 
-		while (cursor_1 != cursor_end_1) {
-			if (!eq(*cursor_1, *cursor_2)) {
-				return false;
-			}
+				while (cursor_1 != cursor_end_1) {
+					if (!eq(*cursor_1, *cursor_2)) {
+						return false;
+					}
 
-			cursor_1++;
-			cursor_2++;
-		}
-#else
-		std::vector<ElementT> idlist_a, idlist_b;
+					cursor_1++;
+					cursor_2++;
+				}
+			} else {
+				std::vector<ElementT> idlist_a, idlist_b;
 
-		for (const auto value : *a) {
-			idlist_a.push_back(value);
-		}
+				for (const auto value : *a) {
+					idlist_a.push_back(value);
+				}
 
-		for (const auto value : *b) {
-			idlist_b.push_back(value);
-		}
+				for (const auto value : *b) {
+					idlist_b.push_back(value);
+				}
 
-		std::sort(idlist_a.begin(), idlist_a.end());
-		std::sort(idlist_b.begin(), idlist_b.end());
+				std::sort(idlist_a.begin(), idlist_a.end());
+				std::sort(idlist_b.begin(), idlist_b.end());
 
-		for (std::size_t i = 0; i < idlist_a.size(); i++) {
-			if (!eq(idlist_a[i] != idlist_b[i])) {
-				return false;
+				for (std::size_t i = 0; i < idlist_a.size(); i++) {
+					if (!eq(idlist_a[i], idlist_b[i])) {
+						return false;
+					}
+				}
 			}
+
+			return true;
 		}
-#endif
+	}
 
-		return true;
+	inline bool operator()(const SetT &a, const SetT &b) const {
+		return (*this)(&a, &b);
 	}
 };
 
 /**
- * @brief      Hasher for set types.
- *
- * @tparam     SetT      The set type (like std::set or std::unordered_set)
- * @tparam     ElementT  The element type of the set (the first template param
- *                       of SetT)
+ * @brief      Finalizer from MurmurHash3. Spreads every input bit over the
+ *             whole word, which std::hash (the identity, for integers) does
+ *             not.
  */
-template<typename SetT, typename ElementT>
-struct SetHash {
-	std::size_t operator()(const SetT *k) const {
-		std::vector<ElementT> idlist_a;
-
-		for (const auto value : *k) {
-			idlist_a.push_back(value);
-		}
-
-		std::sort(idlist_a.begin(), idlist_a.end());
-
-		// Adapted from boost::hash_combine
-		size_t hash_value = 0;
-		for (const auto value : idlist_a) {
-			hash_value ^=
-				std::hash<ElementT>()(value) +
-				0x9e3779b9 + (hash_value << 6) + (hash_value >> 2);
-		}
+inline std::uint64_t hash_mix(std::uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
 
-		return hash_value;
+/**
+ * @brief      The hash of one element, as it contributes to the hash of a set
+ *             (see SetHash).
+ */
+template<typename T>
+struct ElementHash {
+	inline std::size_t operator()(const T &e) const {
+		return static_cast<std::size_t>(hash_mix(std::hash<T>()(e)));
 	}
 };
 
 /**
- * @brief      Struct that is thrown on an assertion failure.
+ * @brief      Identifies a property set backend in snapshots.
  */
-struct AssertError : public std::invalid_argument {
-	AssertError(const std::string &message):
-		std::invalid_argument(message.c_str()) {}
+enum class BackendKind : std::uint32_t {
+	SORTED_VECTOR = 0,
+	ORDERED_SET   = 1,
+	HASH_TABLE    = 2,
+	BITMAP        = 3,
+	TREAP         = 4
 };
 
-#define __STR(x) #x
-#define STR(x) __STR(x)
-#define EXCEPT(x) AssertError(x " [At: " __FILE__ ":" STR(__LINE__) "]")
-
-#ifdef LHF_ENABLE_DEBUG
+/**
+ * @brief      Property set backend: sorted, duplicate-free vectors, interned
+ *             into a slab arena (see InlineSet). This is the `Backend`
+ *             parameter of LatticeHashForest, which picks how its property
+ *             sets are represented. Every backend provides:
+ *
+ *             * `Set<T, Less>`: the property set type
+ *             * `KIND`: identifies the backend in snapshots
+ *             * `ORDERED`: whether sets iterate in ascending order
+ *             * `NATIVE_OPERATIONS`: whether the set type implements
+ *               equality and the set operations itself, on whole containers
+ *               or subtrees rather than element by element
+ *             * `STORES_HASH`: whether sets keep their own SetHash
+ */
+struct SortedVectorBackend {
+	template<typename T, typename Less>
+	using Set = std::vector<T>;
+
+	static const constexpr BackendKind KIND = BackendKind::SORTED_VECTOR;
+	static const constexpr bool ORDERED = true;
+	static const constexpr bool NATIVE_OPERATIONS = false;
+	static const constexpr bool STORES_HASH = false;
+};
 
-/// Check whether the index is a valid index within the property set.
-/// @note Signed/unsigned is made to be ignored here for the sanity checking.
-#define LHF_PROPERTY_SET_INDEX_VALID(index) { \
-	_Pragma("GCC diagnostic push"); \
-	_Pragma("GCC diagnostic ignored \"-Wtype-limits\"") \
-	if ((index) < 0 || ((index) > property_sets.size() - 1)) { \
-		throw EXCEPT("Invalid index supplied"); \
-	} \
-	_Pragma("GCC diagnostic pop") \
-}
+/**
+ * @brief      Property set backend: std::set.
+ */
+struct OrderedSetBackend {
+	template<typename T, typename Less>
+	using Set = std::set<T, Less>;
+
+	static const constexpr BackendKind KIND = BackendKind::ORDERED_SET;
+	static const constexpr bool ORDERED = true;
+	static const constexpr bool NATIVE_OPERATIONS = false;
+	static const constexpr bool STORES_HASH = false;
+};
 
+/**
+ * @brief      Property set backend: std::unordered_set.
+ */
+struct HashTableBackend {
+	template<typename T, typename Less>
+	using Set = std::unordered_set<T>;
+
+	static const constexpr BackendKind KIND = BackendKind::HASH_TABLE;
+	static const constexpr bool ORDERED = false;
+	static const constexpr bool NATIVE_OPERATIONS = false;
+	static const constexpr bool STORES_HASH = false;
+};
 
-/// Check whether the pair of indexes is a valid within the property set.
-#define LHF_PROPERTY_SET_PAIR_VALID(index1, index2) \
-	LHF_PROPERTY_SET_INDEX_VALID(index1); \
-	LHF_PROPERTY_SET_INDEX_VALID(index2);
+/**
+ * @brief      Property set backend: compressed bitmaps (see Bitmap). Only
+ *             for integral properties, in their natural order.
+ */
+struct BitmapBackend {
+	template<typename T, typename Less>
+	struct SetOf {
+		// Bitmaps iterate in increasing order whatever the comparator, and
+		// ordered traversals (for_each_in_range, set_filter) rely on it.
+		static_assert(std::is_same<Less, std::less<T>>::value,
+			"Bitmap property sets only support std::less as the comparator");
+		using type = Bitmap<T>;
+	};
 
-/// Check whether the pair of indexes are unequal. Used for sanity checking.
-#define LHF_PROPERTY_SET_PAIR_UNEQUAL(index1, index2) \
-	if ((index1) == (index2)) { \
-		throw EXCEPT("Equal set condition not handled by caller"); \
-	}
+	template<typename T, typename Less>
+	using Set = typename SetOf<T, Less>::type;
 
-#else
+	static const constexpr BackendKind KIND = BackendKind::BITMAP;
+	static const constexpr bool ORDERED = true;
+	static const constexpr bool NATIVE_OPERATIONS = true;
+	static const constexpr bool STORES_HASH = false;
+};
 
-#define LHF_PROPERTY_SET_INDEX_VALID(index)
-#define LHF_PROPERTY_SET_PAIR_VALID(index1, index2)
-#define LHF_PROPERTY_SET_PAIR_UNEQUAL(index1, index2)
+/**
+ * @brief      Property set backend: hash-consed treaps that share structure
+ *             between sets (see Treap).
+ */
+struct TreapBackend {
+	template<typename T, typename Less>
+	using Set = Treap<T, Less, ElementHash<T>>;
+
+	static const constexpr BackendKind KIND = BackendKind::TREAP;
+	static const constexpr bool ORDERED = true;
+	static const constexpr bool NATIVE_OPERATIONS = true;
+	static const constexpr bool STORES_HASH = true;
+};
 
+// The backend used by forests that do not name one, chosen by the
+// LHF_USE_*_FOR_PROPERTY_SETS options (see lhf_config.hpp).
+#if defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS)
+using DefaultBackend = OrderedSetBackend;
+#elif defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS)
+using DefaultBackend = SortedVectorBackend;
+#elif defined(LHF_USE_BITMAP_FOR_PROPERTY_SETS)
+using DefaultBackend = BitmapBackend;
+#elif defined(LHF_USE_TREAP_FOR_PROPERTY_SETS)
+using DefaultBackend = TreapBackend;
+#else
+using DefaultBackend = HashTableBackend;
 #endif
 
-
-#if defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS)
-
 /**
- * \def LHF_PUSH_ONE(__cont, __val)
- * @brief      Pushes one element to a PropertySet. Use this when implementing
- *             operations.
- *
- * @param      __cont  The container object
- * @param      __val   The value
+ * @brief      Hasher for set types. The hash of a set is the sum of the mixed
+ *             hashes of its elements. It does not depend on iteration order,
+ *             so unordered containers need no sorting, and adding or removing
+ *             one element updates it in O(1) (see element_hash).
  *
+ * @tparam     SetT      The set type (like std::set or std::unordered_set)
+ * @tparam     ElementT  The element type of the set (the first template param
+ *                       of SetT)
+ * @tparam     Backend   The property set backend SetT belongs to
  */
-#define LHF_PUSH_ONE(__cont, __val) (__cont).push_back((__val))
+template<typename SetT, typename ElementT, typename Backend>
+struct SetHash {
+	/**
+	 * @brief      The contribution of one element to the hash of a set: add
+	 *             it to the hash when the element is added, and subtract it
+	 *             when the element is removed.
+	 */
+	static inline std::size_t element_hash(const ElementT &e) {
+		return ElementHash<ElementT>()(e);
+	}
+
+	template<typename Iterator>
+	static std::size_t hash_range(Iterator begin, Iterator end) {
+		std::size_t hash_value = 0;
+		for (; begin != end; begin++) {
+			hash_value += element_hash(*begin);
+		}
+
+		return hash_value;
+	}
+
+	std::size_t operator()(const SetT *k) const {
+		if constexpr (Backend::STORES_HASH) {
+			// Treaps keep this sum for every subtree.
+			return k->hash();
+		} else {
+			return hash_range(k->begin(), k->end());
+		}
+	}
+
+	std::size_t operator()(const SetT &k) const {
+		return (*this)(&k);
+	}
+};
 
 /**
- * \def LHF_PUSH_RANGE(__cont, __start, __end)
- * @brief      Pushes a range of elements to a PropertySet using an iterator.
- *             Use this when implementing operations.
- *
- * @param      __cont  The container object
- * @param      __start The start of the range (e.g. input.begin())
- * @param      __end   The end of the range (e.g. input.end())
+ * @brief      A set, or a reference to one, paired with the hash of that set.
+ *             The hash is computed once when the set is interned (or probed
+ *             for), so neither lookups nor rehashes of the property set map
+ *             need to walk the elements again. Interned sets are stored with
+ *             their hash too, so it can be read back by index.
  *
+ * @tparam     SetRefT  How the set is held (a pointer, a view, or an entry of
+ *                      the property set storage array).
  */
-#define LHF_PUSH_RANGE(__cont, __start, __end) (__cont).insert((__cont).end(), (__start), (__end))
-
-#else
-
-#define LHF_PUSH_ONE(__cont, __val) (__cont).insert((__val))
-#define LHF_PUSH_RANGE(__cont, __start, __end) (__cont).insert((__start), (__end))
+template<typename SetRefT>
+struct HashedSet {
+	SetRefT set;
+	std::size_t hash;
+};
 
-#endif
+template<typename SetRefT>
+struct HashedSetHash {
+	inline std::size_t operator()(const HashedSet<SetRefT> &k) const {
+		return k.hash;
+	}
+};
 
-struct HintNone {
-	static const constexpr bool recursive = false;
-	
+template<typename SetRefT, typename SetEqualT>
+struct HashedSetEqual {
+	inline bool operator()(const HashedSet<SetRefT> &a, const HashedSet<SetRefT> &b) const {
+		return a.hash == b.hash && SetEqualT()(a.set, b.set);
+	}
 };
 
-struct HintRecursive {
-	static const constexpr bool recursive = true;
+template<typename SetRefT, typename SetLessT>
+struct HashedSetLess {
+	inline bool operator()(const HashedSet<SetRefT> &a, const HashedSet<SetRefT> &b) const {
+		if (a.hash != b.hash) {
+			return a.hash < b.hash;
+		}
+		return SetLessT()(a.set, b.set);
+	}
+};
 
+/**
+ * @brief      Hasher for lists of set indices. The lists are kept sorted and
+ *             free of duplicates, so they hash like sets.
+ */
+struct IndexListHash {
+	inline std::size_t operator()(const Vector<Index> &k) const {
+		return SetHash<Vector<Index>, Index, SortedVectorBackend>::hash_range(k.begin(), k.end());
+	}
 };
 
 /**
- * @brief      The main LatticeHashForest structure.
- *             This class can be used as-is with a type or derived for
- *             additional functionality as needed
- *
+ * @brief      A read-only view over a contiguous run of elements. This is what
+ *             the forest hands out for sets stored in the arena. It is cheap
+ *             to copy and stays valid for the lifetime of the forest.
  *
- * @tparam     PropertyT      The type of the property.
- *                            The property type must satisfy the following:
- *                            * It must be hashable with std::hash
- *                            * It must be less-than comparable
- *                            * It can be checked for equality
- *
- * @tparam     PropertyLess   Custom less-than comparator (if required)
- * @tparam     PropertyEqual  Custom equality comaparator (if required)
+ * @tparam     T     The element type.
  */
-template <
-	typename PropertyT,
-	typename HintType = HintNone,
-	typename PropertyLess = std::less<PropertyT>,
-	typename PropertyEqual = std::equal_to<PropertyT>>
-struct LatticeHashForest {
+template<typename T>
+struct SetView {
+	using value_type = T;
+	using iterator = const T *;
+	using const_iterator = const T *;
+
+	const T *ptr = nullptr;
+	std::size_t len = 0;
+
+	SetView() = default;
+	SetView(const T *ptr, std::size_t len): ptr(ptr), len(len) {}
+	SetView(const std::vector<T> &v): ptr(v.data()), len(v.size()) {}
+
+	inline const T *begin() const { return ptr; }
+	inline const T *end() const { return ptr + len; }
+	inline const T *data() const { return ptr; }
+	inline std::size_t size() const { return len; }
+	inline bool empty() const { return len == 0; }
+	inline const T &operator[](std::size_t i) const { return ptr[i]; }
+	inline const T &front() const { return ptr[0]; }
+	inline const T &back() const { return ptr[len - 1]; }
+};
 
-	/**
-	 * @brief      Used to store a subset relation between two set indices.
-	 *             Because the index pair must be in sorted order to prevent
-	 *             duplicates, it necessitates this enum.
-	 */
-	enum SubsetRelation {
-		UNKNOWN  = 0,
-		SUBSET   = 1,
-		SUPERSET = 2
+/**
+ * @brief      Bump allocator for set elements. Elements are copied into large
+ *             fixed-size slabs that are never moved or freed individually, so
+ *             a stored run can be referred to by a plain SetView.
+ *
+ * @tparam     T     The element type.
+ */
+template<typename T>
+struct SlabArena {
+	struct Slab {
+		UniquePointer<T[]> data;
+		std::size_t used;
+		std::size_t capacity;
 	};
 
-#if defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS)
-	using PropertySet = std::set<PropertyT>;
-#elif defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS)
-	using PropertySet = std::vector<PropertyT>;
-#else
-	using PropertySet = std::unordered_set<PropertyT>;
-#endif
+	Vector<Slab> slabs = {};
 
-#ifdef LHF_USE_ORDERED_MAP_FOR_PROPERTY_SET_MAP
-	using PropertySetMap =
-		std::map<
-			PropertySet *, Index,
-			SetLess<PropertySet, PropertyT, PropertyLess>>;
-#else
-	using PropertySetMap =
-		std::unordered_map<
-			PropertySet *, Index,
-			SetHash<PropertySet, PropertyT>,
-			SetEqual<PropertySet, PropertyT, PropertyEqual>>;
-#endif
+	// Index of the slab that small runs are currently carved out of.
+	std::size_t current = NO_SLAB;
 
-	using UnaryOperationMap = HashMap<Index, Index>;
-	using BinaryOperationMap = HashMap<OperationNode, Index>;
+	std::size_t slab_size = LHF_ARENA_SLAB_SIZE;
 
+	static const constexpr std::size_t NO_SLAB = static_cast<std::size_t>(-1);
 
-#ifdef LHF_ENABLE_PERFORMANCE_METRICS
 	/**
-	 * @brief      Operation performance Statistics.
+	 * @brief      Reserves space for `n` contiguous elements.
+	 *
+	 * @param[in]  n     The number of elements
+	 *
+	 * @return     Pointer to the start of the reserved run.
 	 */
-	struct OperationPerf {
-		// Number of direct hits (operation pair in map)
-		size_t hits = 0;
+	T *allocate(std::size_t n) {
+		if (n > slab_size) {
+			// Oversized runs get a dedicated slab so that they do not waste
+			// the tail of the current one.
+			slabs.push_back({UniquePointer<T[]>(new T[n]), n, n});
+			return slabs.back().data.get();
+		}
 
-		// Number of equal hits (both arguments consist of the same set)
-		size_t equal_hits = 0;
+		if (current == NO_SLAB || slabs[current].capacity - slabs[current].used < n) {
+			slabs.push_back({UniquePointer<T[]>(new T[slab_size]), 0, slab_size});
+			current = slabs.size() - 1;
+		}
+
+		Slab &slab = slabs[current];
+		T *ret = slab.data.get() + slab.used;
+		slab.used += n;
+		return ret;
+	}
+
+	/**
+	 * @brief      Copies a range of elements into the arena.
+	 *
+	 * @return     A view over the stored copy.
+	 */
+	template<typename Iterator>
+	SetView<T> store(Iterator begin, Iterator end) {
+		std::size_t n = std::distance(begin, end);
+
+		if (n == 0) {
+			return SetView<T>();
+		}
+
+		T *ret = allocate(n);
+		std::copy(begin, end, ret);
+		return SetView<T>(ret, n);
+	}
+
+	/**
+	 * @brief      Returns the bytes held by the slabs, used or not.
+	 */
+	std::size_t memory_usage() const {
+		std::size_t bytes = heap_bytes(slabs);
+		for (const Slab &slab : slabs) {
+			bytes += slab.capacity * sizeof(T);
+		}
+		return bytes;
+	}
+};
+
+/**
+ * @brief      Struct that is thrown on an assertion failure.
+ */
+struct AssertError : public std::invalid_argument {
+	AssertError(const std::string &message):
+		std::invalid_argument(message.c_str()) {}
+};
+
+#define __STR(x) #x
+#define STR(x) __STR(x)
+#define EXCEPT(x) AssertError(x " [At: " __FILE__ ":" STR(__LINE__) "]")
+
+/**
+ * @brief      Flat, open-addressing hash map from operand pairs to results.
+ *             This is used for the binary operation caches. Both operand
+ *             indices are packed into a single 64-bit key, and collisions are
+ *             resolved by linear probing, so a lookup touches one contiguous
+ *             run of slots and allocates nothing.
+ *
+ *             The map can be given a memory budget. Once the table has grown
+ *             as large as the budget allows, each insertion into a full table
+ *             first evicts an entry by the CLOCK policy: every slot has a
+ *             reference bit that lookups set, and a hand sweeps the table,
+ *             clearing set bits and evicting the first entry whose bit is
+ *             already clear. Evicted slots are refilled by shifting back the
+ *             rest of their probe run, so lookups never see tombstones.
+ *
+ * @note       Operand indices must fit in 32 bits.
+ *
+ * @tparam     V     The value type.
+ */
+template<typename V>
+struct OperationMap {
+	using Key = std::uint64_t;
+
+	// Marks an unused slot. This packs the pair (2^32 - 1, 2^32 - 1), which
+	// is never stored since operations on equal operands are not cached.
+	static const constexpr Key EMPTY_KEY = ~static_cast<Key>(0);
+
+	static const constexpr std::size_t INITIAL_CAPACITY = 16;
+
+	struct Slot {
+		Key key;
+		V value;
+	};
+
+	Vector<Slot> slots = {};
+	std::size_t count = 0;
+
+	// Largest table size the budget allows, or 0 if unbounded.
+	std::size_t max_slots = 0;
+
+	// CLOCK state, only kept while bounded: a reference bit per slot and the
+	// position of the hand.
+	mutable Vector<std::uint8_t> referenced = {};
+	std::size_t hand = 0;
+
+	// One bit per slot, set from the hash of every evicted key. A miss on a
+	// key whose bit is set counts as a re-derivation. This can overcount when
+	// keys collide, but never misses one.
+	Vector<std::uint64_t> evicted_keys = {};
+
+	std::size_t evictions = 0;
+	mutable std::size_t rederivations = 0;
+
+	static inline Key pack(Index left, Index right) {
+#ifdef LHF_ENABLE_DEBUG
+		if (left > 0xFFFFFFFFu || right > 0xFFFFFFFFu) {
+			throw EXCEPT("Operand index does not fit in 32 bits");
+		}
+#endif
+		return (static_cast<Key>(left) << 32) | static_cast<Key>(right);
+	}
+
+	static inline OperationNode unpack(Key k) {
+		return {static_cast<Index>(k >> 32), static_cast<Index>(k & 0xFFFFFFFFu)};
+	}
+
+	// Consecutive indices differ only in their low bits, so these need to be
+	// spread over the whole word before masking.
+	static inline std::size_t mix(Key k) {
+		return static_cast<std::size_t>(hash_mix(k));
+	}
+
+	inline std::size_t size() const {
+		return count;
+	}
+
+	inline bool is_bounded() const {
+		return max_slots != 0;
+	}
+
+	/**
+	 * @brief      Returns a pointer to the value stored for the operand pair,
+	 *             or nullptr if there is none.
+	 */
+	inline const V *find(const OperationNode &op) const {
+		const Key k = pack(op.left, op.right);
+		const std::size_t i = position(k);
+
+		if (i == NOT_FOUND) {
+			note_miss(k);
+			return nullptr;
+		}
+
+		if (is_bounded()) {
+			referenced[i] = 1;
+		}
+		return &slots[i].value;
+	}
+
+	static const constexpr std::size_t NOT_FOUND = ~static_cast<std::size_t>(0);
+
+	// Returns the slot holding `k`, or NOT_FOUND.
+	inline std::size_t position(Key k) const {
+		if (count == 0) {
+			return NOT_FOUND;
+		}
+
+		const std::size_t mask = slots.size() - 1;
+
+		for (std::size_t i = mix(k) & mask; ; i = (i + 1) & mask) {
+			if (slots[i].key == k) {
+				return i;
+			}
+
+			if (slots[i].key == EMPTY_KEY) {
+				return NOT_FOUND;
+			}
+		}
+	}
+
+	inline void note_miss(Key k) const {
+		if (!evicted_keys.empty()) {
+			const std::size_t bit = mix(k) & (evicted_keys.size() * 64 - 1);
+			if (evicted_keys[bit / 64] & (std::uint64_t(1) << (bit % 64))) {
+				rederivations++;
+			}
+		}
+	}
+
+	/**
+	 * @brief      Stores a value for the operand pair. Like
+	 *             std::unordered_map::insert, an existing value is kept.
+	 *
+	 * @param[out] evicted  If not null, receives the entry evicted to make
+	 *                      room, or a slot with EMPTY_KEY if there was none.
+	 *
+	 * @return     `true` if the value was inserted.
+	 */
+	bool insert(const OperationNode &op, const V &value, Slot *evicted = nullptr) {
+		const Key k = pack(op.left, op.right);
+
+		if (evicted != nullptr) {
+			evicted->key = EMPTY_KEY;
+		}
+
+		if ((count + 1) * 4 > slots.size() * 3) {
+			if (is_bounded() && slots.size() >= max_slots) {
+				if (position(k) != NOT_FOUND) {
+					return false;
+				}
+
+				Slot victim = evict();
+				if (evicted != nullptr) {
+					*evicted = victim;
+				}
+			} else {
+				grow();
+			}
+		}
+
+		const std::size_t mask = slots.size() - 1;
+
+		for (std::size_t i = mix(k) & mask; ; i = (i + 1) & mask) {
+			if (slots[i].key == k) {
+				return false;
+			}
+
+			if (slots[i].key == EMPTY_KEY) {
+				slots[i] = {k, value};
+				count++;
+				return true;
+			}
+		}
+	}
+
+	/**
+	 * @brief      Removes one entry chosen by the CLOCK policy, and returns it.
+	 *             The table must not be empty.
+	 */
+	Slot evict() {
+		const std::size_t mask = slots.size() - 1;
+
+		for (;;) {
+			const std::size_t i = hand;
+			hand = (hand + 1) & mask;
+
+			if (slots[i].key == EMPTY_KEY) {
+				continue;
+			}
+
+			if (referenced[i]) {
+				referenced[i] = 0;
+				continue;
+			}
+
+			const Slot victim = slots[i];
+			const std::size_t bit = mix(victim.key) & (evicted_keys.size() * 64 - 1);
+			evicted_keys[bit / 64] |= std::uint64_t(1) << (bit % 64);
+			erase_at(i);
+			evictions++;
+			return victim;
+		}
+	}
+
+	/**
+	 * @brief      Empties slot `i`, then moves later entries of the same probe
+	 *             run back into the gap wherever their home slot allows it,
+	 *             so that no run is broken.
+	 */
+	void erase_at(std::size_t i) {
+		const std::size_t mask = slots.size() - 1;
+
+		for (std::size_t j = (i + 1) & mask;
+			 slots[j].key != EMPTY_KEY;
+			 j = (j + 1) & mask) {
+			const std::size_t home = mix(slots[j].key) & mask;
+
+			// The entry must stay put if its home lies cyclically in (i, j].
+			const bool stays = i <= j
+				? (i < home && home <= j)
+				: (i < home || home <= j);
+
+			if (!stays) {
+				slots[i] = slots[j];
+				referenced[i] = referenced[j];
+				i = j;
+			}
+		}
+
+		slots[i].key = EMPTY_KEY;
+		referenced[i] = 0;
+		count--;
+	}
+
+	/**
+	 * @brief      Limits the table to `bytes` of memory, counting the slots
+	 *             and their CLOCK bits, or lifts the limit if `bytes` is 0.
+	 *             The budget always allows at least INITIAL_CAPACITY slots.
+	 *             If the table is already larger, it is shrunk, evicting
+	 *             entries as needed.
+	 */
+	void set_budget(std::size_t bytes) {
+		if (bytes == 0) {
+			max_slots = 0;
+			referenced.clear();
+			evicted_keys.clear();
+			return;
+		}
+
+		const std::size_t slot_bytes = sizeof(Slot) + sizeof(std::uint8_t);
+		max_slots = INITIAL_CAPACITY;
+		while (max_slots * 2 * slot_bytes <= bytes) {
+			max_slots *= 2;
+		}
+
+		evicted_keys.assign((max_slots + 63) / 64, 0);
+
+		if (slots.size() <= max_slots) {
+			referenced.assign(slots.size(), 0);
+			return;
+		}
+
+		Vector<Slot> old = std::move(slots);
+		slots.assign(max_slots, Slot{EMPTY_KEY, V()});
+		referenced.assign(max_slots, 0);
+		count = 0;
+		hand = 0;
+
+		for (const Slot &s : old) {
+			if (s.key != EMPTY_KEY) {
+				insert(unpack(s.key), s.value);
+			}
+		}
+	}
+
+	/**
+	 * @brief      Returns the bytes held by the table and the eviction state.
+	 */
+	std::size_t memory_usage() const {
+		return heap_bytes(slots) + heap_bytes(referenced) + heap_bytes(evicted_keys);
+	}
+
+	/**
+	 * @brief      Removes every entry. The budget and the counters are kept.
+	 */
+	void clear() {
+		slots.clear();
+		referenced.clear();
+		count = 0;
+		hand = 0;
+		std::fill(evicted_keys.begin(), evicted_keys.end(), 0);
+	}
+
+	void grow() {
+		Vector<Slot> old = std::move(slots);
+		slots.assign(
+			old.empty() ? INITIAL_CAPACITY : old.size() * 2,
+			Slot{EMPTY_KEY, V()});
+
+		if (is_bounded()) {
+			referenced.assign(slots.size(), 0);
+		}
+
+		const std::size_t mask = slots.size() - 1;
+
+		for (const Slot &s : old) {
+			if (s.key == EMPTY_KEY) {
+				continue;
+			}
+
+			std::size_t i = mix(s.key) & mask;
+			while (slots[i].key != EMPTY_KEY) {
+				i = (i + 1) & mask;
+			}
+			slots[i] = s;
+		}
+	}
+
+	/**
+	 * @brief      Iterates over the stored entries as (OperationNode, value)
+	 *             pairs, in no particular order.
+	 */
+	struct const_iterator {
+		const Slot *cursor;
+		const Slot *end;
+
+		inline void skip_empty() {
+			while (cursor != end && cursor->key == EMPTY_KEY) {
+				cursor++;
+			}
+		}
+
+		inline std::pair<OperationNode, V> operator*() const {
+			return {unpack(cursor->key), cursor->value};
+		}
+
+		inline const_iterator &operator++() {
+			cursor++;
+			skip_empty();
+			return *this;
+		}
+
+		inline bool operator!=(const const_iterator &other) const {
+			return cursor != other.cursor;
+		}
+	};
+
+	const_iterator begin() const {
+		const_iterator i = {slots.data(), slots.data() + slots.size()};
+		i.skip_empty();
+		return i;
+	}
+
+	const_iterator end() const {
+		return {slots.data() + slots.size(), slots.data() + slots.size()};
+	}
+};
+
+/**
+ * @brief      An operation cache split into independently locked shards.
+ *             A key always lands in the same shard, chosen from the high bits
+ *             of its mixed hash (the shard's own table uses the low bits).
+ *             Without LHF_ENABLE_CONCURRENCY there is a single shard and the
+ *             lock is a no-op.
+ *
+ * @tparam     V     The value type.
+ */
+template<typename V>
+struct ShardedOperationMap {
+#ifdef LHF_ENABLE_CONCURRENCY
+	static const constexpr std::size_t SHARD_COUNT = LHF_CONCURRENT_SHARD_COUNT;
+#else
+	static const constexpr std::size_t SHARD_COUNT = 1;
+#endif
+
+	static_assert((SHARD_COUNT & (SHARD_COUNT - 1)) == 0,
+		"Shard count must be a power of two");
+
+	struct Shard {
+		mutable Mutex mutex;
+		OperationMap<V> map;
+	};
+
+	Shard shards[SHARD_COUNT];
+
+	ShardedOperationMap() {
+		set_budget(LHF_OPERATION_CACHE_BUDGET);
+	}
+
+	/**
+	 * @brief      Limits the whole map to about `bytes` of memory, split
+	 *             evenly over the shards, or lifts the limit if `bytes` is 0.
+	 *             Must not run concurrently with anything else.
+	 */
+	void set_budget(std::size_t bytes) {
+		for (Shard &s : shards) {
+			s.map.set_budget(bytes == 0 ? 0 : std::max<std::size_t>(bytes / SHARD_COUNT, 1));
+		}
+	}
+
+	inline Shard &shard_of(const OperationNode &op) {
+		const std::size_t h = OperationMap<V>::mix(OperationMap<V>::pack(op.left, op.right));
+		return shards[(h >> 32) & (SHARD_COUNT - 1)];
+	}
+
+	inline const Shard &shard_of(const OperationNode &op) const {
+		return const_cast<ShardedOperationMap *>(this)->shard_of(op);
+	}
+
+	/**
+	 * @brief      Looks up the operand pair. The value is copied out, since
+	 *             the slot may move as soon as the shard is unlocked.
+	 *
+	 * @return     `true` if there is a value for the pair.
+	 */
+	inline bool find(const OperationNode &op, V &value) const {
+		const Shard &s = shard_of(op);
+		LockGuard lock(s.mutex);
+		const V *cursor = s.map.find(op);
+
+		if (cursor == nullptr) {
+			return false;
+		}
+
+		value = *cursor;
+		return true;
+	}
+
+	inline bool insert(const OperationNode &op, const V &value) {
+		Shard &s = shard_of(op);
+		LockGuard lock(s.mutex);
+		return s.map.insert(op, value);
+	}
+
+	/**
+	 * @brief      Like insert(), but also reports the entry that was evicted
+	 *             to make room, if any.
+	 *
+	 * @param[out] evicted      The evicted entry, if there was one.
+	 * @param[out] has_evicted  Whether an entry was evicted.
+	 *
+	 * @return     `true` if the value was inserted.
+	 */
+	inline bool insert(const OperationNode &op, const V &value,
+	                   std::pair<OperationNode, V> &evicted, bool &has_evicted) {
+		Shard &s = shard_of(op);
+		typename OperationMap<V>::Slot victim;
+		bool inserted;
+		{
+			LockGuard lock(s.mutex);
+			inserted = s.map.insert(op, value, &victim);
+		}
+
+		has_evicted = victim.key != OperationMap<V>::EMPTY_KEY;
+		if (has_evicted) {
+			evicted = {OperationMap<V>::unpack(victim.key), victim.value};
+		}
+		return inserted;
+	}
+
+	std::size_t size() const {
+		std::size_t ret = 0;
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			ret += s.map.size();
+		}
+		return ret;
+	}
+
+	// Bytes held by the tables of all shards.
+	std::size_t memory_usage() const {
+		std::size_t ret = 0;
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			ret += s.map.memory_usage();
+		}
+		return ret;
+	}
+
+	// Number of entries evicted to stay within the budget.
+	std::size_t evictions() const {
+		std::size_t ret = 0;
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			ret += s.map.evictions;
+		}
+		return ret;
+	}
+
+	// Number of lookups that missed because their entry had been evicted.
+	std::size_t rederivations() const {
+		std::size_t ret = 0;
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			ret += s.map.rederivations;
+		}
+		return ret;
+	}
+
+	/**
+	 * @brief      Calls `f` with every (OperationNode, value) pair. Each shard
+	 *             is locked while it is being visited.
+	 */
+	template<typename Func>
+	void for_each(Func f) const {
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			for (auto i : s.map) {
+				f(i);
+			}
+		}
+	}
+
+	/**
+	 * @brief      Rewrites the map in place. `f` is called with a mutable key
+	 *             and value for every entry, and returns whether to keep it.
+	 *             Kept entries are rehashed, since their keys may change.
+	 *             Must not run concurrently with anything else.
+	 */
+	template<typename Func>
+	void rewrite(Func f) {
+		Vector<std::pair<OperationNode, V>> kept;
+
+		for (Shard &s : shards) {
+			for (auto i : s.map) {
+				if (f(i.first, i.second)) {
+					kept.push_back(i);
+				}
+			}
+			s.map.clear();
+		}
+
+		for (const auto &i : kept) {
+			insert(i.first, i.second);
+		}
+	}
+
+	/**
+	 * @brief      Writes every shard's probe table, slot for slot.
+	 */
+	void save(SnapshotWriter &w) const {
+		for (const Shard &s : shards) {
+			LockGuard lock(s.mutex);
+			w.write<std::uint64_t>(s.map.slots.size());
+			w.write<std::uint64_t>(s.map.count);
+			for (const auto &slot : s.map.slots) {
+				w.write<std::uint64_t>(slot.key);
+				w.write<std::uint64_t>(static_cast<std::uint64_t>(slot.value));
+			}
+		}
+	}
+
+	/**
+	 * @brief      A probe table written by save(), inside a snapshot.
+	 */
+	struct SnapshotTable {
+		std::uint64_t capacity;
+		std::uint64_t count;
+		const std::uint64_t *slots;
+	};
+
+	/**
+	 * @brief      Reads the tables written by save() and checks them, without
+	 *             changing any map. Each table must lie within the file and be
+	 *             a well-formed probe table, and each entry must name operands
+	 *             below `set_count` and be accepted by `valid_entry` (given
+	 *             the operands and the stored word of the value).
+	 *
+	 * @throws     SnapshotError otherwise.
+	 */
+	template<typename EntryCheck>
+	static Vector<SnapshotTable> read_tables(
+			SnapshotReader &r, std::size_t shard_count,
+			std::uint64_t set_count, const EntryCheck &valid_entry) {
+		Vector<SnapshotTable> tables;
+
+		for (std::size_t i = 0; i < shard_count; i++) {
+			const std::uint64_t capacity = r.read<std::uint64_t>();
+			const std::uint64_t count = r.read<std::uint64_t>();
+
+			// Checked before multiplying, which could wrap around.
+			if (capacity > r.remaining() / (2 * sizeof(std::uint64_t))) {
+				throw SnapshotError("Snapshot is truncated");
+			}
+			const std::uint64_t *table = r.take<std::uint64_t>(capacity * 2);
+
+			// Tables are never more than 3/4 full (see OperationMap::insert),
+			// so probing always reaches an empty slot.
+			if ((capacity & (capacity - 1)) != 0 || count > capacity / 4 * 3) {
+				throw SnapshotError("Snapshot has a malformed operation table");
+			}
+
+			std::uint64_t occupied = 0;
+			for (std::size_t j = 0; j < capacity; j++) {
+				if (table[2 * j] == OperationMap<V>::EMPTY_KEY) {
+					continue;
+				}
+
+				const OperationNode op = OperationMap<V>::unpack(table[2 * j]);
+				if (op.left >= set_count || op.right >= set_count ||
+					!valid_entry(op, table[2 * j + 1])) {
+					throw SnapshotError("Snapshot has a malformed operation table entry");
+				}
+				occupied++;
+			}
+
+			if (occupied != count) {
+				throw SnapshotError("Snapshot has a malformed operation table");
+			}
+
+			tables.push_back({capacity, count, table});
+		}
+
+		return tables;
+	}
+
+	/**
+	 * @brief      Loads tables returned by read_tables(). If the snapshot was
+	 *             written with as many shards as this map has, each table is
+	 *             copied as is. Otherwise, or if this map has a budget, its
+	 *             entries are reinserted.
+	 */
+	void load(const Vector<SnapshotTable> &tables) {
+		for (std::size_t i = 0; i < tables.size(); i++) {
+			const std::uint64_t *table = tables[i].slots;
+			const std::uint64_t capacity = tables[i].capacity;
+
+			if (tables.size() == SHARD_COUNT && !shards[i].map.is_bounded()) {
+				OperationMap<V> &map = shards[i].map;
+				map.slots.resize(capacity);
+				for (std::size_t j = 0; j < capacity; j++) {
+					map.slots[j] = {table[2 * j], static_cast<V>(table[2 * j + 1])};
+				}
+				map.count = tables[i].count;
+				continue;
+			}
+
+			for (std::size_t j = 0; j < capacity; j++) {
+				if (table[2 * j] != OperationMap<V>::EMPTY_KEY) {
+					insert(OperationMap<V>::unpack(table[2 * j]), static_cast<V>(table[2 * j + 1]));
+				}
+			}
+		}
+	}
+};
+
+/**
+ * @brief      Append-only array whose elements never move. Storage is a
+ *             fixed directory of chunks, each twice the size of the one
+ *             before it, so an index maps to a chunk with a single bit scan.
+ *             With LHF_ENABLE_CONCURRENCY, appends may run concurrently with
+ *             each other and with reads; an element may be read without
+ *             locking once its index has been handed out by the appending
+ *             thread.
+ *
+ * @note       `size()` counts reserved slots, which includes slots whose
+ *             appends are still in progress.
+ *
+ * @tparam     T     The element type. Must be default constructible.
+ */
+template<typename T>
+struct StableVector {
+	using value_type = T;
+
+	static const constexpr std::size_t FIRST_CHUNK_BITS = 10;
+	static const constexpr std::size_t CHUNK_COUNT = 48;
+
+	std::atomic<T *> chunks[CHUNK_COUNT] = {};
+	std::atomic<std::size_t> count = {0};
+
+	// Only taken to allocate a new chunk.
+	Mutex grow_mutex;
+
+	StableVector() = default;
+	StableVector(const StableVector &) = delete;
+	StableVector &operator=(const StableVector &) = delete;
+
+	~StableVector() {
+		for (auto &c : chunks) {
+			delete[] c.load(std::memory_order_relaxed);
+		}
+	}
+
+	static inline std::size_t chunk_of(std::size_t i) {
+		return 63 - __builtin_clzll((i >> FIRST_CHUNK_BITS) + 1);
+	}
+
+	static inline std::size_t chunk_start(std::size_t c) {
+		return ((static_cast<std::size_t>(1) << c) - 1) << FIRST_CHUNK_BITS;
+	}
+
+	static inline std::size_t chunk_size(std::size_t c) {
+		return static_cast<std::size_t>(1) << (c + FIRST_CHUNK_BITS);
+	}
+
+	inline std::size_t size() const {
+		return count.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief      Returns the bytes held by the allocated chunks.
+	 */
+	std::size_t memory_usage() const {
+		std::size_t bytes = 0;
+		for (std::size_t c = 0; c < CHUNK_COUNT; c++) {
+			if (chunks[c].load(std::memory_order_acquire) != nullptr) {
+				bytes += chunk_size(c) * sizeof(T);
+			}
+		}
+		return bytes;
+	}
+
+	inline const T &operator[](std::size_t i) const {
+		const std::size_t c = chunk_of(i);
+		return chunks[c].load(std::memory_order_acquire)[i - chunk_start(c)];
+	}
+
+	inline T &operator[](std::size_t i) {
+		const std::size_t c = chunk_of(i);
+		return chunks[c].load(std::memory_order_acquire)[i - chunk_start(c)];
+	}
+
+	/**
+	 * @brief      Removes every element. Must not run concurrently with
+	 *             anything else.
+	 */
+	void clear() {
+		for (auto &c : chunks) {
+			delete[] c.exchange(nullptr, std::memory_order_relaxed);
+		}
+		count.store(0, std::memory_order_release);
+	}
+
+	/**
+	 * @brief      Exchanges contents with `other`. Must not run concurrently
+	 *             with anything else.
+	 */
+	void swap(StableVector &other) {
+		for (std::size_t c = 0; c < CHUNK_COUNT; c++) {
+			T *mine = chunks[c].load(std::memory_order_relaxed);
+			chunks[c].store(other.chunks[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			other.chunks[c].store(mine, std::memory_order_relaxed);
+		}
+		std::size_t mine = count.load(std::memory_order_relaxed);
+		count.store(other.count.load(std::memory_order_relaxed), std::memory_order_release);
+		other.count.store(mine, std::memory_order_release);
+	}
+
+	/**
+	 * @brief      Appends an element.
+	 *
+	 * @return     The index of the new element.
+	 */
+	Index push_back(T &&value) {
+		const std::size_t i = count.fetch_add(1, std::memory_order_acq_rel);
+		const std::size_t c = chunk_of(i);
+		T *chunk = chunks[c].load(std::memory_order_acquire);
+
+		if (chunk == nullptr) {
+			LockGuard lock(grow_mutex);
+			chunk = chunks[c].load(std::memory_order_relaxed);
+			if (chunk == nullptr) {
+				chunk = new T[chunk_size(c)];
+				chunks[c].store(chunk, std::memory_order_release);
+			}
+		}
+
+		chunk[i - chunk_start(c)] = std::move(value);
+		return i;
+	}
+};
+
+template<typename T>
+inline std::size_t heap_bytes(const StableVector<T> &v) {
+	return v.memory_usage();
+}
+
+template<typename T>
+inline Index push_indexed(StableVector<T> &v, T &&value) {
+	return v.push_back(std::move(value));
+}
+
+template<typename T>
+inline Index push_indexed(Vector<T> &v, T &&value) {
+	v.push_back(std::move(value));
+	return v.size() - 1;
+}
+
+#ifdef LHF_ENABLE_CONCURRENCY
+// Elements must not move while other threads are reading them.
+template<typename T>
+using IndexedStorage = StableVector<T>;
+#else
+template<typename T>
+using IndexedStorage = Vector<T>;
+#endif
+
+/**
+ * @brief      Entry of the property set index table for sorted vector sets.
+ *             Small sets are stored inline in the entry itself; larger ones
+ *             point into a slab arena. Reading a small set then touches only
+ *             the table, and costs no arena space.
+ *
+ *             An entry is a 32-bit length followed by either the elements
+ *             (from the next suitably aligned offset) or, at offset 8, a
+ *             pointer to them. So with the default 16 bytes an entry is no
+ *             larger than a plain view, and holds up to three 32-bit or one
+ *             64-bit element inline.
+ *
+ *             Entries must not move once views of them have been handed out,
+ *             so they are kept in a StableVector.
+ *
+ * @tparam     T      The element type. Only trivial types are stored inline.
+ * @tparam     BYTES  The size of an entry (at least 16).
+ */
+template<typename T, std::size_t BYTES>
+struct InlineSet {
+	static const constexpr std::size_t SIZE = BYTES < 16 ? 16 : (BYTES + 7) / 8 * 8;
+	static const constexpr std::size_t POINTER_OFFSET = 8;
+	static const constexpr std::size_t ITEMS_OFFSET =
+		(sizeof(std::uint32_t) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+	static const constexpr std::size_t CAPACITY =
+		std::is_trivial<T>::value && alignof(T) <= 8 && ITEMS_OFFSET < SIZE ?
+			(SIZE - ITEMS_OFFSET) / sizeof(T) : 0;
+
+	alignas(8) unsigned char bytes[SIZE] = {};
+
+	inline std::size_t size() const {
+		std::uint32_t len;
+		std::memcpy(&len, bytes, sizeof(len));
+		return len;
+	}
+
+	inline bool is_inline() const {
+		return size() <= CAPACITY;
+	}
+
+	inline SetView<T> view() const {
+		const std::size_t len = size();
+
+		if (len <= CAPACITY) {
+			return SetView<T>(reinterpret_cast<const T *>(bytes + ITEMS_OFFSET), len);
+		}
+
+		const T *ptr;
+		std::memcpy(&ptr, bytes + POINTER_OFFSET, sizeof(ptr));
+		return SetView<T>(ptr, len);
+	}
+
+	/**
+	 * @brief      Makes an entry for a run that already lives in permanent
+	 *             storage (such as a mapped snapshot). Small runs are still
+	 *             copied inline.
+	 */
+	static InlineSet refer(const T *data, std::size_t n) {
+		InlineSet ret;
+		ret.set_size(n);
+
+		if (n <= CAPACITY) {
+			std::copy(data, data + n, reinterpret_cast<T *>(ret.bytes + ITEMS_OFFSET));
+		} else {
+			std::memcpy(ret.bytes + POINTER_OFFSET, &data, sizeof(data));
+		}
+
+		return ret;
+	}
+
+	/**
+	 * @brief      Makes an entry for a range, copying it inline if it is small
+	 *             enough and into `arena` otherwise.
+	 */
+	template<typename Iterator>
+	static InlineSet store(Iterator begin, Iterator end, SlabArena<T> &arena) {
+		const std::size_t n = std::distance(begin, end);
+
+		if (n <= CAPACITY) {
+			InlineSet ret;
+			ret.set_size(n);
+			std::copy(begin, end, reinterpret_cast<T *>(ret.bytes + ITEMS_OFFSET));
+			return ret;
+		}
+
+		return refer(arena.store(begin, end).data(), n);
+	}
+
+	inline void set_size(std::size_t n) {
+#ifdef LHF_ENABLE_DEBUG
+		if (n > 0xFFFFFFFFu) {
+			throw EXCEPT("Property set does not fit a 32-bit length");
+		}
+#endif
+		const std::uint32_t len = static_cast<std::uint32_t>(n);
+		std::memcpy(bytes, &len, sizeof(len));
+	}
+};
+
+#ifdef LHF_ENABLE_DEBUG
+
+/// Check whether the index is a valid index within the property set.
+/// @note Signed/unsigned is made to be ignored here for the sanity checking.
+#define LHF_PROPERTY_SET_INDEX_VALID(index) { \
+	_Pragma("GCC diagnostic push"); \
+	_Pragma("GCC diagnostic ignored \"-Wtype-limits\"") \
+	if ((index) < 0 || ((index) > property_sets.size() - 1)) { \
+		throw EXCEPT("Invalid index supplied"); \
+	} \
+	_Pragma("GCC diagnostic pop") \
+}
+
+
+/// Check whether the pair of indexes is a valid within the property set.
+#define LHF_PROPERTY_SET_PAIR_VALID(index1, index2) \
+	LHF_PROPERTY_SET_INDEX_VALID(index1); \
+	LHF_PROPERTY_SET_INDEX_VALID(index2);
+
+/// Check whether the pair of indexes are unequal. Used for sanity checking.
+#define LHF_PROPERTY_SET_PAIR_UNEQUAL(index1, index2) \
+	if ((index1) == (index2)) { \
+		throw EXCEPT("Equal set condition not handled by caller"); \
+	}
+
+#else
+
+#define LHF_PROPERTY_SET_INDEX_VALID(index)
+#define LHF_PROPERTY_SET_PAIR_VALID(index1, index2)
+#define LHF_PROPERTY_SET_PAIR_UNEQUAL(index1, index2)
+
+#endif
+
+
+/**
+ * @brief      Adds one element to a property set that is being built in
+ *             order. Vectors append it; the other set types insert it.
+ */
+template<typename SetT, typename T>
+inline void push_one(SetT &c, const T &v) {
+	c.insert(v);
+}
+
+template<typename T, typename A, typename V>
+inline void push_one(std::vector<T, A> &c, const V &v) {
+	c.push_back(v);
+}
+
+/**
+ * @brief      Adds the elements of [begin, end) to a property set, like
+ *             push_one.
+ */
+template<typename SetT, typename Iterator>
+inline void push_range(SetT &c, Iterator begin, Iterator end) {
+	c.insert(begin, end);
+}
+
+template<typename T, typename A, typename Iterator>
+inline void push_range(std::vector<T, A> &c, Iterator begin, Iterator end) {
+	c.insert(c.end(), begin, end);
+}
+
+/**
+ * \def LHF_PUSH_ONE(__cont, __val)
+ * @brief      Pushes one element to a PropertySet. Use this when implementing
+ *             operations. Works with the sets of any backend.
+ *
+ * @param      __cont  The container object
+ * @param      __val   The value
+ *
+ */
+#define LHF_PUSH_ONE(__cont, __val) ::lhf::push_one((__cont), (__val))
+
+/**
+ * \def LHF_PUSH_RANGE(__cont, __start, __end)
+ * @brief      Pushes a range of elements to a PropertySet using an iterator.
+ *             Use this when implementing operations.
+ *
+ * @param      __cont  The container object
+ * @param      __start The start of the range (e.g. input.begin())
+ * @param      __end   The end of the range (e.g. input.end())
+ *
+ */
+#define LHF_PUSH_RANGE(__cont, __start, __end) ::lhf::push_range((__cont), (__start), (__end))
+
+/**
+ * @brief      Breakdown of the memory held by a forest, in bytes (see
+ *             LatticeHashForest::memory_usage).
+ */
+struct MemoryUsage {
+	// Elements of the interned sets: arena slabs for sorted vectors, the set
+	// objects and what they allocate otherwise.
+	std::size_t set_payload = 0;
+
+	// The property set storage array: one entry (and hash) per set.
+	std::size_t set_overhead = 0;
+
+	// The interning maps, and the shortcuts for single-element sets.
+	std::size_t property_set_map = 0;
+
+	std::size_t unions = 0;
+	std::size_t intersections = 0;
+	std::size_t differences = 0;
+	std::size_t subsets = 0;
+
+	// Known supersets of each set, used for subset inference.
+	std::size_t superset_edges = 0;
+
+	// Cached results of set_union_many.
+	std::size_t unions_many = 0;
+
+	// Mapped snapshot file that sets loaded from it point into.
+	std::size_t snapshot = 0;
+
+	std::size_t total() const {
+		return set_payload + set_overhead + property_set_map +
+			unions + intersections + differences + subsets +
+			superset_edges + unions_many + snapshot;
+	}
+
+	String to_string() const {
+		std::stringstream s;
+		s << "      " << "Set Payload     : " << set_payload << "\n"
+		  << "      " << "Set Overhead    : " << set_overhead << "\n"
+		  << "      " << "Property Set Map: " << property_set_map << "\n"
+		  << "      " << "Unions          : " << unions << "\n"
+		  << "      " << "Intersections   : " << intersections << "\n"
+		  << "      " << "Differences     : " << differences << "\n"
+		  << "      " << "Subsets         : " << subsets << "\n"
+		  << "      " << "Superset Edges  : " << superset_edges << "\n"
+		  << "      " << "Unions Many     : " << unions_many << "\n"
+		  << "      " << "Snapshot        : " << snapshot << "\n"
+		  << "      " << "Total           : " << total() << "\n";
+		return s.str();
+	}
+
+	// Writes the figures as members of the object open in `w`.
+	void write_json(JsonWriter &w) const {
+		w.value("set_payload", set_payload)
+		 .value("set_overhead", set_overhead)
+		 .value("property_set_map", property_set_map)
+		 .value("unions", unions)
+		 .value("intersections", intersections)
+		 .value("differences", differences)
+		 .value("subsets", subsets)
+		 .value("superset_edges", superset_edges)
+		 .value("unions_many", unions_many)
+		 .value("snapshot", snapshot)
+		 .value("total", total());
+	}
+};
+
+struct HintNone {
+	static const constexpr bool recursive = false;
+	
+};
+
+struct HintRecursive {
+	static const constexpr bool recursive = true;
+
+};
+
+/**
+ * @brief      The main LatticeHashForest structure.
+ *             This class can be used as-is with a type or derived for
+ *             additional functionality as needed
+ *
+ *
+ * @tparam     PropertyT      The type of the property.
+ *                            The property type must satisfy the following:
+ *                            * It must be hashable with std::hash
+ *                            * It must be less-than comparable
+ *                            * It can be checked for equality
+ *
+ * @tparam     PropertyLess   Custom less-than comparator (if required)
+ * @tparam     PropertyEqual  Custom equality comaparator (if required)
+ * @tparam     Backend        How property sets are represented (see
+ *                            SortedVectorBackend). Forests with different
+ *                            backends can be used side by side.
+ */
+template <
+	typename PropertyT,
+	typename HintType = HintNone,
+	typename PropertyLess = std::less<PropertyT>,
+	typename PropertyEqual = std::equal_to<PropertyT>,
+	typename Backend = DefaultBackend>
+struct LatticeHashForest {
+
+	/**
+	 * @brief      Used to store a subset relation between two set indices.
+	 *             Because the index pair must be in sorted order to prevent
+	 *             duplicates, it necessitates this enum.
+	 */
+	enum SubsetRelation {
+		UNKNOWN      = 0,
+		SUBSET       = 1,
+		SUPERSET     = 2,
+		INCOMPARABLE = 3
+	};
+
+	using PropertySet = typename Backend::template Set<PropertyT, PropertyLess>;
+
+	// Identifies the property set backend in snapshots.
+	static const constexpr BackendKind BACKEND = Backend::KIND;
+
+	// Sorted vector sets are interned into a slab arena, and are handed out
+	// as views into it. The other backends store each set on its own.
+	static const constexpr bool ARENA_SETS = BACKEND == BackendKind::SORTED_VECTOR;
+
+	using PropertySetView = std::conditional_t<ARENA_SETS,
+		SetView<PropertyT>, const PropertySet &>;
+	using PropertySetRef = std::conditional_t<ARENA_SETS,
+		SetView<PropertyT>, const PropertySet *>;
+	using PropertySetEntry = std::conditional_t<ARENA_SETS,
+		InlineSet<PropertyT, LHF_INLINE_SET_BYTES>, UniquePointer<PropertySet>>;
+	using PropertySetStorage = std::conditional_t<ARENA_SETS,
+		StableVector<HashedSet<PropertySetEntry>>,
+		IndexedStorage<HashedSet<PropertySetEntry>>>;
+
+	// The set type that the hash, equality and ordering of interned sets
+	// are defined on.
+	using ComparedSet = std::conditional_t<ARENA_SETS,
+		SetView<PropertyT>, PropertySet>;
+	using PropertySetHash = SetHash<ComparedSet, PropertyT, Backend>;
+	using PropertySetEqual = SetEqual<ComparedSet, PropertyT, PropertyEqual, Backend>;
+	using PropertySetLess = SetLess<ComparedSet, PropertyT, PropertyLess>;
+
+	// Merge kernels for union, intersection and difference of sorted vectors.
+	using SortedKernels = simd::SortedSetKernels<PropertyT, PropertyLess>;
+
+	// Backing memory for the elements of interned sets, when they are kept
+	// in an arena.
+	struct NoArena {};
+	using PropertySetArena = std::conditional_t<ARENA_SETS, SlabArena<PropertyT>, NoArena>;
+
+	// Key of the property set map: a reference to the set with its hash.
+	using PropertySetKey = HashedSet<PropertySetRef>;
+
+#ifdef LHF_USE_ORDERED_MAP_FOR_PROPERTY_SET_MAP
+	using PropertySetMap =
+		std::map<
+			PropertySetKey, Index,
+			HashedSetLess<PropertySetRef, PropertySetLess>>;
+#else
+	using PropertySetMap =
+		std::unordered_map<
+			PropertySetKey, Index,
+			HashedSetHash<PropertySetRef>,
+			HashedSetEqual<PropertySetRef, PropertySetEqual>>;
+#endif
+
+	using UnaryOperationMap = HashMap<Index, Index>;
+	using BinaryOperationMap = ShardedOperationMap<Index>;
+
+	using SingletonMap = std::unordered_map<PropertyT, Index, std::hash<PropertyT>, PropertyEqual>;
+
+	// Keyed by the sorted, deduplicated operand list.
+	using NaryOperationMap = std::unordered_map<Vector<Index>, Index, IndexListHash>;
+
+	// set_union_many only looks for subset relations among its operands
+	// when there are at most this many, since it costs a probe per pair.
+	static const constexpr std::size_t UNION_MANY_SUBSET_SCAN_LIMIT = 32;
+
+#ifdef LHF_ENABLE_CONCURRENCY
+	static const constexpr std::size_t PROPERTY_SET_SHARD_COUNT = LHF_CONCURRENT_SHARD_COUNT;
+#else
+	static const constexpr std::size_t PROPERTY_SET_SHARD_COUNT = 1;
+#endif
+
+	/**
+	 * @brief      One shard of the interning table. Sets are assigned to a
+	 *             shard by hash, and a shard is only locked while it is being
+	 *             probed or extended, so threads interning different sets
+	 *             rarely wait on each other.
+	 */
+	struct PropertySetShard {
+		mutable Mutex mutex;
+
+		// The property set -> Index in storage array mapping.
+		PropertySetMap map = {};
+
+		// Shortcut for single-element sets: element -> Index of {element}.
+		// Elements are assigned to shards by their own hash.
+		SingletonMap singletons = {};
+
+		// Backing memory for the elements of the sets interned here.
+		PropertySetArena arena = {};
+	};
+
+
+#ifdef LHF_ENABLE_PERFORMANCE_METRICS
+	/**
+	 * @brief      Operation performance Statistics.
+	 */
+	struct OperationPerf {
+		// Number of direct hits (operation pair in map)
+		size_t hits = 0;
+
+		// Number of equal hits (both arguments consist of the same set)
+		size_t equal_hits = 0;
 
 		// Number of subset hits (operation pair not in but resolvable using
 		// subset relation)
@@ -429,6 +1939,22 @@ struct LatticeHashForest {
 		// in map. Node in lattice exists, but not the edges)
 		size_t edge_misses = 0;
 
+		// Number of subset tests answered negatively from the sizes or the
+		// smallest and largest elements of the sets alone
+		size_t bound_rejections = 0;
+
+		// Number of cache entries evicted to stay within the budget (see
+		// LHF_OPERATION_CACHE_BUDGET)
+		size_t evictions = 0;
+
+		// Number of misses on operation pairs whose entries had been evicted,
+		// which had to be computed again
+		size_t rederivations = 0;
+
+		// Sizes of the operands, and of the results, of the operation
+		Histogram input_sizes;
+		Histogram output_sizes;
+
 		String to_string() {
 			std::stringstream s;
 			s << "      " << "Hits       : " << hits << "\n"
@@ -436,45 +1962,157 @@ struct LatticeHashForest {
 			  << "      " << "Subset Hits: " << subset_hits << "\n"
 			  << "      " << "Empty Hits : " << empty_hits << "\n"
 			  << "      " << "Cold Misses: " << cold_misses << "\n"
-			  << "      " << "Edge Misses: " << edge_misses << "\n";
+			  << "      " << "Edge Misses: " << edge_misses << "\n"
+			  << "      " << "Rejections : " << bound_rejections << "\n"
+			  << "      " << "Evictions  : " << evictions << "\n"
+			  << "      " << "Rederived  : " << rederivations << "\n";
+			if (input_sizes.count) {
+				s << "      " << "Input Size : " << input_sizes.to_string() << "\n";
+			}
+			if (output_sizes.count) {
+				s << "      " << "Output Size: " << output_sizes.to_string() << "\n";
+			}
 			return s.str();
 		}
+
+		void write_json(JsonWriter &w) const {
+			w.value("hits", hits)
+			 .value("equal_hits", equal_hits)
+			 .value("subset_hits", subset_hits)
+			 .value("empty_hits", empty_hits)
+			 .value("cold_misses", cold_misses)
+			 .value("edge_misses", edge_misses)
+			 .value("bound_rejections", bound_rejections)
+			 .value("evictions", evictions)
+			 .value("rederivations", rederivations);
+			w.begin_object("input_sizes");
+			input_sizes.write_json(w);
+			w.end_object().begin_object("output_sizes");
+			output_sizes.write_json(w);
+			w.end_object();
+		}
+
+		bool empty() const {
+			return hits + equal_hits + subset_hits + empty_hits +
+				cold_misses + edge_misses + bound_rejections + evictions + rederivations +
+				input_sizes.count + output_sizes.count == 0;
+		}
+	};
+
+	/**
+	 * @brief      Names of the operations that statistics are kept for. An
+	 *             operation's position here indexes `perf`.
+	 */
+	struct PerfNames {
+		std::mutex mutex;
+		Vector<String> names;
 	};
 
-	HashMap<String, OperationPerf> perf;
+	static PerfNames &perf_names() {
+		static PerfNames names;
+		return names;
+	}
+
+	/**
+	 * @brief      Interns an operation name. LHF_PERF_INC does this once per
+	 *             use, so counting is an array access rather than a lookup
+	 *             by string.
+	 */
+	static std::size_t perf_id(const String &name) {
+		PerfNames &p = perf_names();
+		std::lock_guard<std::mutex> lock(p.mutex);
+		auto cursor = std::find(p.names.begin(), p.names.end(), name);
+
+		if (cursor != p.names.end()) {
+			return cursor - p.names.begin();
+		}
+
+		p.names.push_back(name);
+		return p.names.size() - 1;
+	}
+
+	inline OperationPerf &perf_of(std::size_t id) {
+		if (id >= perf.size()) {
+			perf.resize(id + 1);
+		}
+		return perf[id];
+	}
+
+	// Statistics of each operation, indexed by perf_id().
+	Vector<OperationPerf> perf;
 
-#define LHF_PERF_INC(__oper, __category) (perf[STR(__oper)] . __category ++)
+#define LHF_PERF_INC(__oper, __category) do { \
+	static const std::size_t __LHF_PERF_ID__ = perf_id(STR(__oper)); \
+	perf_of(__LHF_PERF_ID__) . __category ++; \
+} while (0)
+
+// Records a set size into the input_sizes or output_sizes histogram.
+#define LHF_PERF_SIZE(__oper, __histogram, __size) do { \
+	static const std::size_t __LHF_PERF_ID__ = perf_id(STR(__oper)); \
+	perf_of(__LHF_PERF_ID__) . __histogram . record(__size); \
+} while (0)
 
 #else
 
 #define LHF_PERF_INC(__oper, __category)
+#define LHF_PERF_SIZE(__oper, __histogram, __size)
 
 #endif
 
-	// The property set storage array.
-	Vector<UniquePointer<PropertySet>> property_sets = {};
+	// The property set storage array. Reads of interned sets never lock.
+	PropertySetStorage property_sets = {};
 
-	// The property set -> Index in storage array mapping.
-	PropertySetMap property_set_map = {};
+	PropertySetShard property_set_shards[PROPERTY_SET_SHARD_COUNT];
 
 	BinaryOperationMap unions = {};
 	BinaryOperationMap intersections = {};
 	BinaryOperationMap differences = {};
-	HashMap<OperationNode, SubsetRelation> subsets = {};
+	ShardedOperationMap<SubsetRelation> subsets = {};
+
+	// Known supersets of each set, taken from `subsets`. This is what
+	// is_subset_of searches to infer relations transitively. The empty set
+	// has no edges: it is a subset of everything, and is_subset_of answers
+	// that before searching.
+	HashMap<Index, HashSet<Index>> superset_edges = {};
+	mutable Mutex superset_edges_mutex;
+
+	// Results of set_union_many calls that asked to be cached.
+	NaryOperationMap unions_many = {};
+	mutable Mutex unions_many_mutex;
+
+	// Guards the caller-supplied caches of set_filter.
+	Mutex filter_mutex;
+
+#ifndef LHF_ENABLE_CONCURRENCY
+	// Buffer that set operations build their results in (see take_scratch).
+	// Only sorted vector forests use it.
+	PropertySet scratch_set = {};
+#endif
+
+	// The snapshot this forest was loaded from, if any. Sorted vector sets
+	// restored from it point into the mapping, so it lives as long as the
+	// forest does.
+	UniquePointer<MappedFile> snapshot = nullptr;
 
 	inline bool is_empty(const Index i) {
 		return i == EMPTY_SET;
 	}
 
+	/**
+	 * @brief      Returns the cached relation between `a` and `b`, which must
+	 *             be given in index order (a < b). Relations that were never
+	 *             derived or tested come back as UNKNOWN; use is_subset_of for
+	 *             an exact answer.
+	 */
 	SubsetRelation is_subset(const Index a, const Index b) {
 		LHF_PROPERTY_SET_PAIR_VALID(a, b)
 		__lhf_calc_functime();
-		auto i = subsets.find({a, b});
+		SubsetRelation r;
 
-		if (i == subsets.end()) {
+		if (!subsets.find({a, b}, r)) {
 			return UNKNOWN;
 		} else {
-			return i->second;
+			return r;
 		}
 	}
 
@@ -490,12 +2128,231 @@ struct LatticeHashForest {
 		LHF_PROPERTY_SET_PAIR_UNEQUAL(a, b)
 		__lhf_calc_functime();
 
-		// We need to maintain the operation pair in index-order here as well.
-		if (a > b) {
-			subsets.insert({{b, a}, SUPERSET});
+		// We need to maintain the operation pair in index-order here as well.
+		if (a > b) {
+			cache_subset_relation({b, a}, SUPERSET);
+		} else {
+			cache_subset_relation({a, b}, SUBSET);
+		}
+	}
+
+	/**
+	 * @brief      Caches the relation between the sets of `op` (left < right)
+	 *             and keeps `superset_edges` in step with the cache, so that
+	 *             the edges stay within its budget too: a new SUBSET or
+	 *             SUPERSET entry adds its edge, and an entry evicted to make
+	 *             room takes its edge along. Every insertion into `subsets`
+	 *             goes through here.
+	 *
+	 * @return     `true` if the relation was not cached yet.
+	 */
+	bool cache_subset_relation(const OperationNode &op, const SubsetRelation r) {
+		std::pair<OperationNode, SubsetRelation> evicted;
+		bool has_evicted;
+
+		// Held across the insertion, so that another thread cannot evict the
+		// new entry (and erase its edge) before the edge is added.
+		LockGuard lock(superset_edges_mutex);
+		const bool inserted = subsets.insert(op, r, evicted, has_evicted);
+
+		// Other operand pairs can lead to a relation that is already known,
+		// whose edge is already there.
+		if (inserted) {
+			if (r == SUBSET) {
+				add_superset_edge(op.left, op.right);
+			} else if (r == SUPERSET) {
+				add_superset_edge(op.right, op.left);
+			}
+		}
+
+		if (has_evicted) {
+			if (evicted.second == SUBSET) {
+				erase_superset_edge(evicted.first.left, evicted.first.right);
+			} else if (evicted.second == SUPERSET) {
+				erase_superset_edge(evicted.first.right, evicted.first.left);
+			}
+		}
+
+		return inserted;
+	}
+
+	// Adds the edge from `sub` to `super`, unless `sub` is the empty set.
+	// The caller holds superset_edges_mutex.
+	void add_superset_edge(const Index sub, const Index super) {
+		if (!is_empty(sub)) {
+			superset_edges[sub].insert(super);
+		}
+	}
+
+	// Removes the edge from `sub` to `super`. The caller holds
+	// superset_edges_mutex.
+	void erase_superset_edge(const Index sub, const Index super) {
+		auto cursor = superset_edges.find(sub);
+		if (cursor == superset_edges.end()) {
+			return;
+		}
+
+		cursor->second.erase(super);
+		if (cursor->second.empty()) {
+			superset_edges.erase(cursor);
+		}
+	}
+
+	/**
+	 * @brief      Rebuilds `superset_edges` from the subset cache, after the
+	 *             cache has been renumbered or restored.
+	 */
+	void rebuild_superset_edges() {
+		// Collected first, so that no shard lock is held while taking
+		// superset_edges_mutex (cache_subset_relation takes the two the
+		// other way around).
+		Vector<OperationNode> edges;
+		subsets.for_each([&](const std::pair<OperationNode, SubsetRelation> &i) {
+			if (i.second == SUBSET) {
+				edges.push_back({i.first.left, i.first.right});
+			} else if (i.second == SUPERSET) {
+				edges.push_back({i.first.right, i.first.left});
+			}
+		});
+
+		LockGuard lock(superset_edges_mutex);
+		superset_edges.clear();
+		for (const OperationNode &e : edges) {
+			add_superset_edge(e.left, e.right);
+		}
+	}
+
+	/**
+	 * @brief      Tries to prove `a` ⊆ `b` from known subset relations, by a
+	 *             breadth-first search upwards from `a` that visits at most
+	 *             LHF_SUBSET_INFERENCE_LIMIT sets. Sets that are not smaller
+	 *             than `b` are not followed, since they cannot lie on a chain
+	 *             of subsets ending in `b`.
+	 *
+	 * @return     `true` if a chain was found. `false` means unknown.
+	 */
+	bool infer_subset(const Index a, const Index b) {
+		LockGuard lock(superset_edges_mutex);
+
+		if (superset_edges.find(a) == superset_edges.end()) {
+			return false;
+		}
+
+		const std::size_t size_b = size_of(b);
+		Vector<Index> frontier = {a};
+		HashSet<Index> visited = {a};
+
+		for (std::size_t i = 0;
+			 i < frontier.size() && visited.size() <= LHF_SUBSET_INFERENCE_LIMIT;
+			 i++) {
+			auto cursor = superset_edges.find(frontier[i]);
+			if (cursor == superset_edges.end()) {
+				continue;
+			}
+
+			for (Index x : cursor->second) {
+				if (x == b) {
+					return true;
+				}
+
+				if (size_of(x) < size_b && visited.insert(x).second) {
+					frontier.push_back(x);
+				}
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * @brief      Determines exactly whether the set at `a` is a subset of the
+	 *             set at `b`. Cheap checks come first: trivial cases, sizes,
+	 *             the subset cache, the smallest and largest elements, and
+	 *             then a bounded search over known subset relations. Only if
+	 *             all of these are inconclusive are the elements merged.
+	 *             Computed answers are cached in both directions.
+	 *
+	 * @param[in]  a     The candidate subset
+	 * @param[in]  b     The candidate superset
+	 *
+	 * @return     `true` if every element of `a` is in `b`.
+	 */
+	bool is_subset_of(const Index a, const Index b) {
+		LHF_PROPERTY_SET_PAIR_VALID(a, b);
+		__lhf_calc_functime();
+
+		if (a == b || is_empty(a)) {
+			LHF_PERF_INC(subset_tests, equal_hits);
+			return true;
+		} else if (is_empty(b)) {
+			LHF_PERF_INC(subset_tests, empty_hits);
+			return false;
+		}
+
+		PropertySetView first = get_value(a);
+		PropertySetView second = get_value(b);
+
+		// Distinct sets of equal size are incomparable.
+		if (first.size() >= second.size()) {
+			LHF_PERF_INC(subset_tests, bound_rejections);
+			return false;
+		}
+
+		SubsetRelation r = is_subset(std::min(a, b), std::max(a, b));
+		if (r != UNKNOWN) {
+			LHF_PERF_INC(subset_tests, hits);
+			return r == (a < b ? SUBSET : SUPERSET);
+		}
+
+		if constexpr (Backend::ORDERED && !Backend::NATIVE_OPERATIONS) {
+			if (less(*first.begin(), *second.begin()) ||
+				less(*std::prev(second.end()), *std::prev(first.end()))) {
+				LHF_PERF_INC(subset_tests, bound_rejections);
+				cache_subset_relation({std::min(a, b), std::max(a, b)}, INCOMPARABLE);
+				return false;
+			}
+		}
+
+		if (infer_subset(a, b)) {
+			LHF_PERF_INC(subset_tests, subset_hits);
+			store_subset(a, b);
+			return true;
+		}
+
+		bool result;
+		if constexpr (Backend::NATIVE_OPERATIONS) {
+			result = PropertySet::is_subset(first, second);
+		} else if constexpr (ARENA_SETS) {
+			if (is_skewed(first.size(), second.size())) {
+				result = simd::gallop_subset<PropertyT, PropertyLess>(
+					first.data(), first.size(), second.data(), second.size());
+			} else {
+				result = simd::scalar_subset<PropertyT, PropertyLess>(
+					first.data(), first.size(), second.data(), second.size());
+			}
+		} else if constexpr (Backend::ORDERED) {
+			result = std::includes(
+				second.begin(), second.end(), first.begin(), first.end(), PropertyLess());
+		} else {
+			result = true;
+			for (const PropertyT &v : first) {
+				if (second.count(v) == 0) {
+					result = false;
+					break;
+				}
+			}
+		}
+
+		LHF_PERF_INC(subset_tests, cold_misses);
+
+		// `b` is the larger set, so it cannot be a subset of `a` either.
+		if (result) {
+			store_subset(a, b);
 		} else {
-			subsets.insert({{a, b}, SUBSET});
+			cache_subset_relation({std::min(a, b), std::max(a, b)}, INCOMPARABLE);
 		}
+
+		return result;
 	}
 
 	/**
@@ -510,22 +2367,8 @@ struct LatticeHashForest {
 	 */
 	Index register_set_single(const PropertyT &c) {
 		__lhf_calc_functime();
-
-		UniquePointer<PropertySet> new_set =
-			UniquePointer<PropertySet>(new PropertySet{c});
-
-		auto cursor = property_set_map.find(new_set.get());
-
-		if (cursor == property_set_map.end()) {
-			LHF_PERF_INC(property_sets, cold_misses);
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
-			return ret;
-		}
-
-		LHF_PERF_INC(property_sets, hits);
-		return cursor->second;
+		bool cold;
+		return intern_single(c, cold);
 	}
 
 	/**
@@ -540,27 +2383,9 @@ struct LatticeHashForest {
 	 */
 	Index register_set_single(const PropertyT &c, bool &cold) {
 		__lhf_calc_functime();
-
-		std::unique_ptr<PropertySet> new_set =
-			UniquePointer<PropertySet>(new PropertySet{c});
-
-		auto cursor = property_set_map.find(new_set.get());
-
-		if (cursor == property_set_map.end()) {
-			LHF_PERF_INC(property_sets, cold_misses);
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
-			cold = true;
-			return ret;
-		}
-
-		LHF_PERF_INC(property_sets, hits);
-		cold = false;
-		return cursor->second;
+		return intern_single(c, cold);
 	}
 
-#ifdef LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS
 	/**
 	 * Deduplicates and sorts a vector (to function equivalently to a set).
 	 *
@@ -577,61 +2402,79 @@ struct LatticeHashForest {
 		c.assign(deduplicator.begin(), deduplicator.end());
 		std::sort(c.begin(), c.end());
 	}
-#endif
 
 	/**
-	 * @brief         Inserts a (or gets an existing) set into property set
-	 *                storage.
-	 *
-	 * @param[in]  c  The property set.
-	 *
-	 * @return        Index of the newly created set.
+	 * @brief      Adds an entry, and the hash of its set, to the property set
+	 *             storage array.
 	 *
-	 * @todo          Check whether the cache hit check can be removed.
+	 * @return     The index of the entry.
 	 */
-	Index register_set(PropertySet &c) {
-		__lhf_calc_functime();
-
-		auto cursor = property_set_map.find(&c);
+	inline Index append_property_set(PropertySetEntry &&entry, std::size_t hash) {
+		return push_indexed(property_sets, HashedSet<PropertySetEntry>{std::move(entry), hash});
+	}
 
-		if (cursor == property_set_map.end()) {
-			LHF_PERF_INC(property_sets, cold_misses);
-			UniquePointer<PropertySet> new_set =
-				UniquePointer<PropertySet>(new PropertySet(c));
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
-			return ret;
+	/**
+	 * @brief      Refers to `c` the way keys of the property set map do.
+	 */
+	template<typename SetT>
+	static inline PropertySetRef to_ref(const SetT &c) {
+		if constexpr (ARENA_SETS) {
+			return PropertySetView(c);
+		} else {
+			return &c;
 		}
-
-		LHF_PERF_INC(property_sets, hits);
-		return cursor->second;
 	}
 
 	/**
-	 * @brief         Inserts a (or gets an existing) set into property set
-	 *                storage, and reports whether this set was already
-	 *                present or not.
+	 * @brief         Looks up a set in property set storage, and stores a copy
+	 *                of it if it is not present. All the registration
+	 *                functions funnel into this.
 	 *
 	 * @param[in]  c     The property set.
 	 * @param[out] cold  Report if this was a cold miss.
 	 *
 	 * @return        Index of the newly created/existing set.
-	 *
-	 * @todo          Check whether the cache hit check can be removed.
 	 */
-	Index register_set(PropertySet &c, bool &cold) {
-		__lhf_calc_functime();
+	template<typename SetT>
+	Index intern_set(SetT &&c, bool &cold) {
+		const std::size_t hash = PropertySetHash()(c);
+		return intern_set(std::forward<SetT>(c), cold, hash);
+	}
+
+	/**
+	 * @brief      Like intern_set(c, cold), for a set whose hash is already
+	 *             known (say, derived from the hash of another set). A probe
+	 *             only compares elements against sets with the same hash.
+	 */
+	template<typename SetT>
+	Index intern_set(SetT &&c, bool &cold, std::size_t hash) {
+		PropertySetKey key = {to_ref(c), hash};
+
+#ifdef LHF_ENABLE_DEBUG
+		if (hash != PropertySetHash()(key.set)) {
+			throw EXCEPT("Precomputed set hash does not match the set");
+		}
+#endif
+
+		PropertySetShard &shard =
+			property_set_shards[key.hash % PROPERTY_SET_SHARD_COUNT];
+		LockGuard lock(shard.mutex);
 
-		auto cursor = property_set_map.find(&c);
+		auto cursor = shard.map.find(key);
 
-		if (cursor == property_set_map.end()) {
+		if (cursor == shard.map.end()) {
 			LHF_PERF_INC(property_sets, cold_misses);
-			UniquePointer<PropertySet> new_set =
-				UniquePointer<PropertySet>(new PropertySet(c));
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
+			Index ret;
+			if constexpr (ARENA_SETS) {
+				ret = append_property_set(
+					PropertySetEntry::store(c.begin(), c.end(), shard.arena), key.hash);
+				key.set = get_value(ret);
+			} else {
+				PropertySet *stored = new PropertySet(std::forward<SetT>(c));
+				key.set = stored;
+				ret = append_property_set(PropertySetEntry(stored), key.hash);
+			}
+			shard.map.insert(std::make_pair(key, ret));
 			cold = true;
 			return ret;
 		}
@@ -641,44 +2484,142 @@ struct LatticeHashForest {
 		return cursor->second;
 	}
 
-	Index register_set(PropertySet &&c) {
-		__lhf_calc_functime();
+	/**
+	 * @brief      Hands out an empty set for an operation to build its result
+	 *             in. With sorted vectors this is a reusable buffer whose
+	 *             capacity survives between calls, so a result that is
+	 *             already interned costs no allocation at all. The buffer is
+	 *             moved out while in use, so a nested call (say, from a filter
+	 *             function) simply gets a fresh one. Concurrent forests keep
+	 *             one buffer per thread.
+	 *
+	 *             Give the set back through intern_result().
+	 */
+	inline PropertySet take_scratch() {
+		if constexpr (ARENA_SETS) {
+			PropertySet ret = std::move(scratch());
+			ret.clear();
+			return ret;
+		} else {
+			return PropertySet();
+		}
+	}
+
+	inline PropertySet &scratch() {
+#ifdef LHF_ENABLE_CONCURRENCY
+		static thread_local PropertySet buffer;
+		return buffer;
+#else
+		return scratch_set;
+#endif
+	}
 
-		auto cursor = property_set_map.find(&c);
+	/**
+	 * @brief      Interns the result of an operation, built in a set from
+	 *             take_scratch(). The set is only copied (sorted vectors, into
+	 *             the arena) or moved (other backends) into permanent storage
+	 *             on a cold miss.
+	 *
+	 * @param[in]  s     The result.
+	 * @param[out] cold  Report if this was a cold miss.
+	 *
+	 * @return     Index of the newly created/existing set.
+	 */
+	inline Index intern_result(PropertySet &&s, bool &cold) {
+		const std::size_t hash = PropertySetHash()(s);
+		return intern_result(std::move(s), cold, hash);
+	}
 
-		if (cursor == property_set_map.end()) {
-			LHF_PERF_INC(property_sets, cold_misses);
-			UniquePointer<PropertySet> new_set =
-				UniquePointer<PropertySet>(new PropertySet(c));
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
+	// Same as above, for a result whose hash is already known.
+	inline Index intern_result(PropertySet &&s, bool &cold, std::size_t hash) {
+		__lhf_calc_time("register_set");
+		if constexpr (ARENA_SETS) {
+			Index ret = intern_set(PropertySetView(s), cold, hash);
+			scratch() = std::move(s);
 			return ret;
+		} else {
+			return intern_set(std::move(s), cold, hash);
 		}
+	}
 
-		LHF_PERF_INC(property_sets, hits);
-		return cursor->second;
+	/**
+	 * @brief      Interns the set holding just `c`. Singletons that have been
+	 *             registered before are found with a single lookup of the
+	 *             element, without building or hashing a set. Otherwise the
+	 *             set is interned as usual (sorted vectors probe with a view
+	 *             of `c` itself) and remembered.
+	 */
+	inline Index intern_single(const PropertyT &c, bool &cold) {
+		PropertySetShard &shard =
+			property_set_shards[std::hash<PropertyT>()(c) % PROPERTY_SET_SHARD_COUNT];
+
+		{
+			LockGuard lock(shard.mutex);
+			auto cursor = shard.singletons.find(c);
+
+			if (cursor != shard.singletons.end()) {
+				LHF_PERF_INC(property_sets, hits);
+				cold = false;
+				return cursor->second;
+			}
+		}
+
+		// Not under the lock: interning locks the shard of the set's hash,
+		// which may be a different one.
+		Index ret;
+		if constexpr (ARENA_SETS) {
+			ret = intern_set(PropertySetView(&c, 1), cold);
+		} else {
+			ret = intern_set(PropertySet{c}, cold);
+		}
+
+		LockGuard lock(shard.mutex);
+		shard.singletons.insert({c, ret});
+		return ret;
 	}
 
-	Index register_set(PropertySet &&c, bool &cold) {
+	/**
+	 * @brief         Inserts a (or gets an existing) set into property set
+	 *                storage.
+	 *
+	 * @param[in]  c  The property set.
+	 *
+	 * @return        Index of the newly created set.
+	 */
+	Index register_set(PropertySet &c) {
 		__lhf_calc_functime();
+		LHF_PERF_SIZE(property_sets, input_sizes, c.size());
+		bool cold;
+		return intern_set(c, cold);
+	}
 
-		auto cursor = property_set_map.find(&c);
+	/**
+	 * @brief         Inserts a (or gets an existing) set into property set
+	 *                storage, and reports whether this set was already
+	 *                present or not.
+	 *
+	 * @param[in]  c     The property set.
+	 * @param[out] cold  Report if this was a cold miss.
+	 *
+	 * @return        Index of the newly created/existing set.
+	 */
+	Index register_set(PropertySet &c, bool &cold) {
+		__lhf_calc_functime();
+		LHF_PERF_SIZE(property_sets, input_sizes, c.size());
+		return intern_set(c, cold);
+	}
 
-		if (cursor == property_set_map.end()) {
-			LHF_PERF_INC(property_sets, cold_misses);
-			UniquePointer<PropertySet> new_set =
-				UniquePointer<PropertySet>(new PropertySet(c));
-			property_sets.push_back(std::move(new_set));
-			Index ret = property_sets.size() - 1;
-			property_set_map.insert(std::make_pair(property_sets[ret].get(), ret));
-			cold = true;
-			return ret;
-		}
+	Index register_set(PropertySet &&c) {
+		__lhf_calc_functime();
+		LHF_PERF_SIZE(property_sets, input_sizes, c.size());
+		bool cold;
+		return intern_set(std::move(c), cold);
+	}
 
-		LHF_PERF_INC(property_sets, hits);
-		cold = false;
-		return cursor->second;
+	Index register_set(PropertySet &&c, bool &cold) {
+		__lhf_calc_functime();
+		LHF_PERF_SIZE(property_sets, input_sizes, c.size());
+		return intern_set(std::move(c), cold);
 	}
 
 	/**
@@ -688,9 +2629,21 @@ struct LatticeHashForest {
 	 *
 	 * @return     The property set.
 	 */
-	inline const PropertySet &get_value(Index index) const {
+	inline PropertySetView get_value(Index index) const {
+		LHF_PROPERTY_SET_INDEX_VALID(index);
+		if constexpr (ARENA_SETS) {
+			return property_sets[index].set.view();
+		} else {
+			return *property_sets[index].set.get();
+		}
+	}
+
+	/**
+	 * @brief      Returns the hash of the set at `index` (see SetHash).
+	 */
+	inline std::size_t hash_of(Index index) const {
 		LHF_PROPERTY_SET_INDEX_VALID(index);
-		return *property_sets[index].get();
+		return property_sets[index].hash;
 	}
 
 	/**
@@ -734,6 +2687,24 @@ struct LatticeHashForest {
 		return PropertyEqual()(a, b);
 	}
 
+	/**
+	 * @brief      Determines whether two operand sizes are far enough apart
+	 *             that searching the larger set (galloping) beats a linear
+	 *             merge over both.
+	 */
+	static inline bool is_skewed(std::size_t a, std::size_t b) {
+		return std::min(a, b) * LHF_GALLOPING_SIZE_RATIO <= std::max(a, b);
+	}
+
+	/**
+	 * @brief      Determines whether both operands are inline (small) sets.
+	 *             These are merged directly, since setting up a vector kernel
+	 *             costs more than the whole merge.
+	 */
+	static inline bool is_small(std::size_t a, std::size_t b) {
+		return a <= PropertySetEntry::CAPACITY && b <= PropertySetEntry::CAPACITY;
+	}
+
 	/**
 	 * @brief      Determines whether the property set at `index` contains the
 	 *             element `prop` or not.
@@ -748,37 +2719,99 @@ struct LatticeHashForest {
 			return false;
 		}
 
-		const PropertySet &s = get_value(index);
+		PropertySetView s = get_value(index);
 
-#ifdef LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS
-		if (s.size() <= LHF_SORTED_VECTOR_BINARY_SEARCH_THRESHOLD) {
-			for (PropertyT i : s) {
-				if (equal(i, prop)) {
-					return true;
+		if constexpr (ARENA_SETS) {
+			if (s.size() <= LHF_SORTED_VECTOR_BINARY_SEARCH_THRESHOLD) {
+				for (PropertyT i : s) {
+					if (equal(i, prop)) {
+						return true;
+					}
+				}
+			} else {
+				// Binary search implementation, over the half-open range
+				// [low, high) so that `high` cannot wrap around below zero.
+				std::size_t low = 0;
+				std::size_t high = s.size();
+
+				while (low < high) {
+					std::size_t mid = low + (high - low) / 2;
+
+					if (equal(s[mid], prop)) {
+						return true;
+					} else if (less(s[mid], prop)) {
+						low = mid + 1;
+					} else {
+						high = mid;
+					}
 				}
 			}
 		} else {
-			// Binary search implementation
-			std::size_t low = 0;
-			std::size_t high = s.size() - 1;
+			return s.count(prop) > 0;
+		}
+
+		return false;
+	}
+
+	/**
+	 * @brief      Interns the set at `a` with `x` added. The hash of the
+	 *             result is the hash of `a` plus that of `x`, so the only
+	 *             linear work is copying `a`, and none at all if `x` is
+	 *             already there.
+	 *
+	 * @param[out] cold  Report if this was a cold miss.
+	 */
+	Index insert_element(const Index a, const PropertyT &x, bool &cold) {
+		cold = false;
+		if (contains(a, x)) {
+			return a;
+		}
+
+		PropertySet new_set = take_scratch();
+		PropertySetView s = get_value(a);
+
+		if constexpr (ARENA_SETS) {
+			const PropertyT *pos = std::lower_bound(s.begin(), s.end(), x, PropertyLess());
+			new_set.resize(s.size() + 1);
+			auto cursor = std::copy(s.begin(), pos, new_set.begin());
+			*cursor++ = x;
+			std::copy(pos, s.end(), cursor);
+		} else {
+			new_set = s;
+			new_set.insert(x);
+		}
 
-			while (low <= high) {
-				std::size_t mid = low + (high - low) / 2;
+		return intern_result(std::move(new_set), cold,
+			hash_of(a) + PropertySetHash::element_hash(x));
+	}
 
-				if (equal(s[mid], prop)) {
-					return true;
-				} else if (less(s[mid], prop)) {
-					low = mid + 1;
-				} else {
-					high = mid - 1;
-				}
-			}
+	/**
+	 * @brief      Interns the set at `a` with `x` removed. Like
+	 *             insert_element, the hash of the result is derived from the
+	 *             hash of `a`.
+	 *
+	 * @param[out] cold  Report if this was a cold miss.
+	 */
+	Index remove_element(const Index a, const PropertyT &x, bool &cold) {
+		cold = false;
+		if (!contains(a, x)) {
+			return a;
 		}
-#else
-		return s.count(prop) > 0;
-#endif
 
-		return false;
+		PropertySet new_set = take_scratch();
+		PropertySetView s = get_value(a);
+
+		if constexpr (ARENA_SETS) {
+			const PropertyT *pos = std::lower_bound(s.begin(), s.end(), x, PropertyLess());
+			new_set.resize(s.size() - 1);
+			std::copy(pos + 1, s.end(), std::copy(s.begin(), pos, new_set.begin()));
+		} else {
+			new_set = s;
+			new_set.erase(x);
+		}
+
+		return intern_result(std::move(new_set), cold,
+			hash_of(a) - PropertySetHash::element_hash(x));
 	}
 
 	/**
@@ -790,9 +2823,18 @@ struct LatticeHashForest {
 	 *
 	 * @return     Index of the new property set.
 	 */
-	Index set_union(const Index _a, const Index _b) {
-		LHF_PROPERTY_SET_PAIR_VALID(_a, _b);
-		__lhf_calc_functime();
+	Index set_union(const Index a, const Index b) {
+		LHF_PROPERTY_SET_PAIR_VALID(a, b);
+		__lhf_calc_functime_operands(a, b);
+		LHF_PERF_SIZE(unions, input_sizes, size_of(a));
+		LHF_PERF_SIZE(unions, input_sizes, size_of(b));
+		const Index ret = compute_union(a, b);
+		LHF_PERF_SIZE(unions, output_sizes, size_of(ret));
+		return ret;
+	}
+
+	// set_union, without the validation and the profiling around it.
+	Index compute_union(const Index _a, const Index _b) {
 
 		if (_a == _b) {
 			LHF_PERF_INC(unions, equal_hits);
@@ -820,73 +2862,271 @@ struct LatticeHashForest {
 			return a;
 		}
 
-		auto cursor = unions.find({a, b});
+		Index cached;
+
+		if (!unions.find({a, b}, cached)) {
+			// Adding a single element needs neither a merge nor hashing the
+			// result.
+			if (size_of(a) == 1 || size_of(b) == 1) {
+				bool cold = false;
+				Index ret = size_of(a) == 1
+					? insert_element(b, *get_value(a).begin(), cold)
+					: insert_element(a, *get_value(b).begin(), cold);
+				return cache_union(a, b, ret, cold);
+			}
+
+			PropertySet new_set = take_scratch();
+			PropertySetView first = get_value(a);
+			PropertySetView second = get_value(b);
+
+			if constexpr (Backend::NATIVE_OPERATIONS) {
+				new_set = PropertySet::set_union(first, second);
+			} else if constexpr (ARENA_SETS) {
+				new_set.resize(first.size() + second.size());
+				if (is_small(first.size(), second.size())) {
+					new_set.resize(
+						simd::scalar_union<PropertyT, PropertyLess>(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				} else {
+					new_set.resize(
+						SortedKernels::set_union(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				}
+			} else if constexpr (Backend::ORDERED) {
+				// The union implementation here is adopted from the example
+				// suggested implementation provided of std::set_union from
+				// cppreference.com
+				auto cursor_1 = first.begin();
+				const auto &cursor_end_1 = first.end();
+				auto cursor_2 = second.begin();
+				const auto &cursor_end_2 = second.end();
+
+				while (cursor_1 != cursor_end_1) {
+					if (cursor_2 == cursor_end_2) {
+						LHF_PUSH_RANGE(new_set, cursor_1, cursor_end_1);
+						break;
+					}
+
+					if (less(*cursor_2, *cursor_1)) {
+						LHF_PUSH_ONE(new_set, *cursor_2);
+						cursor_2++;
+					} else {
+						LHF_PUSH_ONE(new_set, *cursor_1);
+						if (!(less(*cursor_1, *cursor_2)))
+							cursor_2++;
+						cursor_1++;
+					}
+				}
+				LHF_PUSH_RANGE(new_set, cursor_2, cursor_end_2);
+			} else {
+				for (auto &v : first) {
+					new_set.insert(v);
+				}
+
+				for (auto &v : second) {
+					new_set.insert(v);
+				}
+			}
+			bool cold = false;
+			Index ret = intern_result(std::move(new_set), cold);
+			return cache_union(a, b, ret, cold);
+		}
+
+		LHF_PERF_INC(unions, hits);
+		return cached;
+	}
+
+	/**
+	 * @brief      Caches `ret` as the union of `a` and `b` (a < b), along with
+	 *             the subset relations it implies.
+	 *
+	 * @return     `ret`
+	 */
+	Index cache_union(const Index a, const Index b, const Index ret, const bool cold) {
+		unions.insert({a, b}, ret);
+
+		if (ret == a) {
+			store_subset(b, ret);
+		} else if (ret == b) {
+			store_subset(a, ret);
+		} else {
+			store_subset(a, ret);
+			store_subset(b, ret);
+		}
+
+		if (cold) {
+			LHF_PERF_INC(unions, cold_misses);
+		} else {
+			LHF_PERF_INC(unions, edge_misses);
+		}
+		return ret;
+	}
+
+	/**
+	 * @brief      Calculates the union of any number of sets at once. The
+	 *             operands are merged in a single pass (a k-way merge driven
+	 *             by a heap), and only the final result is interned, so no
+	 *             intermediate sets or cache entries are created. Empty
+	 *             operands, duplicates, and operands that are known subsets of
+	 *             other operands are skipped before merging.
+	 *
+	 * @param[in]  operands  The indices of the sets to unite
+	 * @param[in]  count     The number of indices
+	 * @param[in]  cache     Whether to cache the result under the operand
+	 *                       list (sorted and deduplicated).
+	 *
+	 * @return     Index of the new property set.
+	 */
+	Index set_union_many(const Index *operands, std::size_t count, bool cache = false) {
+		__lhf_calc_functime();
+
+		Vector<Index> ops;
+		ops.reserve(count);
+		for (std::size_t i = 0; i < count; i++) {
+			LHF_PROPERTY_SET_INDEX_VALID(operands[i]);
+			if (!is_empty(operands[i])) {
+				ops.push_back(operands[i]);
+			}
+		}
+
+		std::sort(ops.begin(), ops.end());
+		ops.erase(std::unique(ops.begin(), ops.end()), ops.end());
+
+		if (ops.size() <= UNION_MANY_SUBSET_SCAN_LIMIT) {
+			Vector<bool> redundant(ops.size(), false);
+			for (std::size_t i = 0; i < ops.size(); i++) {
+				for (std::size_t j = i + 1; j < ops.size(); j++) {
+					if (redundant[i] || redundant[j]) {
+						continue;
+					}
+
+					SubsetRelation r = is_subset(ops[i], ops[j]);
+					if (r == SUBSET) {
+						redundant[i] = true;
+					} else if (r == SUPERSET) {
+						redundant[j] = true;
+					}
+				}
+			}
+
+			std::size_t kept = 0;
+			for (std::size_t i = 0; i < ops.size(); i++) {
+				if (!redundant[i]) {
+					ops[kept++] = ops[i];
+				}
+			}
+			ops.resize(kept);
+		}
+
+		if (ops.empty()) {
+			LHF_PERF_INC(unions_many, empty_hits);
+			return EMPTY_SET;
+		} else if (ops.size() == 1) {
+			LHF_PERF_INC(unions_many, subset_hits);
+			return ops[0];
+		} else if (ops.size() == 2) {
+			// The binary operation is already cached.
+			return set_union(ops[0], ops[1]);
+		}
+
+		if (cache) {
+			LockGuard lock(unions_many_mutex);
+			auto cursor = unions_many.find(ops);
+			if (cursor != unions_many.end()) {
+				LHF_PERF_INC(unions_many, hits);
+				return cursor->second;
+			}
+		}
+
+		PropertySet new_set = take_scratch();
 
-		if (cursor == unions.end()) {
-			PropertySet new_set;
-			const PropertySet &first = get_value(a);
-			const PropertySet &second = get_value(b);
+		if constexpr (Backend::NATIVE_OPERATIONS) {
+			// Bitmap and treap unions already work on whole containers or
+			// subtrees, so fold them without interning the intermediate sets.
+			new_set = get_value(ops[0]);
+			for (std::size_t i = 1; i < ops.size(); i++) {
+				new_set = PropertySet::set_union(new_set, get_value(ops[i]));
+			}
+		} else if constexpr (Backend::ORDERED) {
+			using Cursor = decltype(get_value(EMPTY_SET).begin());
+
+			struct Run {
+				Cursor cursor;
+				Cursor end;
+			};
+
+			// Min-heap on the current element of each run.
+			auto later = [](const Run &x, const Run &y) {
+				return less(*y.cursor, *x.cursor);
+			};
+
+			Vector<Run> runs;
+			runs.reserve(ops.size());
+			std::size_t total = 0;
+			for (Index i : ops) {
+				PropertySetView v = get_value(i);
+				runs.push_back({v.begin(), v.end()});
+				total += v.size();
+			}
 
-#ifdef LHF_USE_ORDERED_CONTAINER_FOR_PROPERTY_SETS
-			// The union implementation here is adopted from the example
-			// suggested implementation provided of std::set_union from
-			// cppreference.com
-			auto cursor_1 = first.begin();
-			const auto &cursor_end_1 = first.end();
-			auto cursor_2 = second.begin();
-			const auto &cursor_end_2 = second.end();
+			if constexpr (ARENA_SETS) {
+				new_set.reserve(total);
+			}
 
-			while (cursor_1 != cursor_end_1) {
-				if (cursor_2 == cursor_end_2) {
-					LHF_PUSH_RANGE(new_set, cursor_1, cursor_end_1);
-					break;
+			std::make_heap(runs.begin(), runs.end(), later);
+
+			while (!runs.empty()) {
+				std::pop_heap(runs.begin(), runs.end(), later);
+				Run &r = runs.back();
+				const PropertyT &v = *r.cursor;
+
+				if (new_set.empty() || !equal(*std::prev(new_set.end()), v)) {
+					LHF_PUSH_ONE(new_set, v);
 				}
 
-				if (less(*cursor_2, *cursor_1)) {
-					LHF_PUSH_ONE(new_set, *cursor_2);
-					cursor_2++;
+				if (++r.cursor == r.end) {
+					runs.pop_back();
 				} else {
-					LHF_PUSH_ONE(new_set, *cursor_1);
-					if (!(less(*cursor_1, *cursor_2)))
-						cursor_2++;
-					cursor_1++;
+					std::push_heap(runs.begin(), runs.end(), later);
 				}
 			}
-			LHF_PUSH_RANGE(new_set, cursor_2, cursor_end_2);
-#else
-			for (auto &v : first) {
-				new_set.insert(v);
-			}
-
-			for (auto &v : second) {
-				new_set.insert(v);
+		} else {
+			for (Index i : ops) {
+				for (auto &v : get_value(i)) {
+					new_set.insert(v);
+				}
 			}
-#endif
-			bool cold = false;
-			Index ret = register_set(new_set, cold);
-
-			unions.insert({{a, b}, ret});
+		}
 
+		bool cold = false;
+		Index ret = intern_result(std::move(new_set), cold);
 
-			if (ret == a) {
-				store_subset(b, ret);
-			} else if (ret == b) {
-				store_subset(a, ret);
-			} else {
-				store_subset(a, ret);
-				store_subset(b, ret);
+		for (Index i : ops) {
+			if (i != ret) {
+				store_subset(i, ret);
 			}
+		}
 
-			if (cold) {
-				LHF_PERF_INC(unions, cold_misses);
-			} else {
-				LHF_PERF_INC(unions, edge_misses);
-			}
-			return ret;
+		if (cache) {
+			LockGuard lock(unions_many_mutex);
+			unions_many.insert({std::move(ops), ret});
 		}
 
-		LHF_PERF_INC(unions, hits);
-		return cursor->second;
+		if (cold) {
+			LHF_PERF_INC(unions_many, cold_misses);
+		} else {
+			LHF_PERF_INC(unions_many, edge_misses);
+		}
+
+		return ret;
+	}
+
+	Index set_union_many(const Vector<Index> &operands, bool cache = false) {
+		return set_union_many(operands.data(), operands.size(), cache);
 	}
 
 	/**
@@ -928,7 +3168,16 @@ struct LatticeHashForest {
 	 */
 	Index set_difference(const Index a, const Index b) {
 		LHF_PROPERTY_SET_PAIR_VALID(a, b);
-		__lhf_calc_functime();
+		__lhf_calc_functime_operands(a, b);
+		LHF_PERF_SIZE(differences, input_sizes, size_of(a));
+		LHF_PERF_SIZE(differences, input_sizes, size_of(b));
+		const Index ret = compute_difference(a, b);
+		LHF_PERF_SIZE(differences, output_sizes, size_of(ret));
+		return ret;
+	}
+
+	// set_difference, without the validation and the profiling around it.
+	Index compute_difference(const Index a, const Index b) {
 
 		if (a == b) {
 			LHF_PERF_INC(differences, equal_hits);
@@ -943,68 +3192,112 @@ struct LatticeHashForest {
 			return a;
 		}
 
-		auto cursor = differences.find({a, b});
-
-		if (cursor == differences.end()) {
-			PropertySet new_set;
-			const PropertySet &first = get_value(a);
-			const PropertySet &second = get_value(b);
-
-#ifdef LHF_USE_ORDERED_CONTAINER_FOR_PROPERTY_SETS
-			// The difference implementation here is adopted from the example
-			// suggested implementation provided of std::set_difference from
-			// cppreference.com
-			auto cursor_1 = first.begin();
-			const auto &cursor_end_1 = first.end();
-			auto cursor_2 = second.begin();
-			const auto &cursor_end_2 = second.end();
+		Index cached;
+
+		if (!differences.find({a, b}, cached)) {
+			// Removing a single element needs neither a merge nor hashing the
+			// result, and a single element is removed entirely or not at all.
+			if (size_of(b) == 1) {
+				bool cold = false;
+				Index ret = remove_element(a, *get_value(b).begin(), cold);
+				return cache_difference(a, b, ret, cold);
+			} else if (size_of(a) == 1) {
+				Index ret = contains(b, *get_value(a).begin()) ? EMPTY_SET : a;
+				return cache_difference(a, b, ret, false);
+			}
 
-			while (cursor_1 != cursor_end_1) {
-				if (cursor_2 == cursor_end_2) {
-					LHF_PUSH_RANGE(new_set, cursor_1, cursor_end_1);
-					break;
+			PropertySet new_set = take_scratch();
+			PropertySetView first = get_value(a);
+			PropertySetView second = get_value(b);
+
+			if constexpr (Backend::NATIVE_OPERATIONS) {
+				new_set = PropertySet::set_difference(first, second);
+			} else if constexpr (ARENA_SETS) {
+				new_set.resize(first.size());
+				if (is_small(first.size(), second.size())) {
+					new_set.resize(
+						simd::scalar_difference<PropertyT, PropertyLess>(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				} else if (is_skewed(first.size(), second.size())) {
+					new_set.resize(
+						simd::gallop_difference<PropertyT, PropertyLess>(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				} else {
+					new_set.resize(
+						SortedKernels::set_difference(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
 				}
+			} else if constexpr (Backend::ORDERED) {
+				// The difference implementation here is adopted from the example
+				// suggested implementation provided of std::set_difference from
+				// cppreference.com
+				auto cursor_1 = first.begin();
+				const auto &cursor_end_1 = first.end();
+				auto cursor_2 = second.begin();
+				const auto &cursor_end_2 = second.end();
+
+				while (cursor_1 != cursor_end_1) {
+					if (cursor_2 == cursor_end_2) {
+						LHF_PUSH_RANGE(new_set, cursor_1, cursor_end_1);
+						break;
+					}
 
-				if (less(*cursor_1, *cursor_2)) {
-					LHF_PUSH_ONE(new_set, *cursor_1);
-					cursor_1++;
-				} else {
-					if (!(less(*cursor_2, *cursor_1)))
+					if (less(*cursor_1, *cursor_2)) {
+						LHF_PUSH_ONE(new_set, *cursor_1);
 						cursor_1++;
-					cursor_2++;
+					} else {
+						if (!(less(*cursor_2, *cursor_1)))
+							cursor_1++;
+						cursor_2++;
+					}
+				}
+			} else {
+				for (auto &v : first) {
+					new_set.insert(v);
 				}
-			}
-#else
-			for (auto &v : first) {
-				new_set.insert(v);
-			}
 
-			for (auto &v : second) {
-				new_set.erase(v);
+				for (auto &v : second) {
+					new_set.erase(v);
+				}
 			}
-#endif
 
 			bool cold = false;
-			Index ret = register_set(new_set, cold);
-			differences.insert({{a, b}, ret});
+			Index ret = intern_result(std::move(new_set), cold);
+			return cache_difference(a, b, ret, cold);
+		}
 
-			if (ret != a) {
-				store_subset(ret, a);
-			} else {
-				intersections.insert({{ std::min(a, b) , std::max(a, b) }, EMPTY_SET});
-			}
+		LHF_PERF_INC(differences, hits);
+		return cached;
+	}
 
-			if (cold) {
-				LHF_PERF_INC(differences, cold_misses);
-			} else {
-				LHF_PERF_INC(differences, edge_misses);
-			}
+	/**
+	 * @brief      Caches `ret` as the difference of `b` from `a`, along with
+	 *             the relations it implies.
+	 *
+	 * @return     `ret`
+	 */
+	Index cache_difference(const Index a, const Index b, const Index ret, const bool cold) {
+		differences.insert({a, b}, ret);
 
-			return ret;
+		if (ret != a) {
+			store_subset(ret, a);
+		} else {
+			intersections.insert({ std::min(a, b) , std::max(a, b) }, EMPTY_SET);
 		}
 
-		LHF_PERF_INC(differences, hits);
-		return cursor->second;
+		if (cold) {
+			LHF_PERF_INC(differences, cold_misses);
+		} else {
+			LHF_PERF_INC(differences, edge_misses);
+		}
+
+		return ret;
 	}
 
 	/**
@@ -1016,9 +3309,18 @@ struct LatticeHashForest {
 	 *
 	 * @return     Index of the new property set.
 	 */
-	Index set_intersection(const Index _a, const Index _b) {
-		LHF_PROPERTY_SET_PAIR_VALID(_a, _b);
-		__lhf_calc_functime();
+	Index set_intersection(const Index a, const Index b) {
+		LHF_PROPERTY_SET_PAIR_VALID(a, b);
+		__lhf_calc_functime_operands(a, b);
+		LHF_PERF_SIZE(intersections, input_sizes, size_of(a));
+		LHF_PERF_SIZE(intersections, input_sizes, size_of(b));
+		const Index ret = compute_intersection(a, b);
+		LHF_PERF_SIZE(intersections, output_sizes, size_of(ret));
+		return ret;
+	}
+
+	// set_intersection, without the validation and the profiling around it.
+	Index compute_intersection(const Index _a, const Index _b) {
 
 		if (_a == _b) {
 			LHF_PERF_INC(intersections, equal_hits);
@@ -1043,49 +3345,75 @@ struct LatticeHashForest {
 			return b;
 		}
 
-		auto cursor = intersections.find({a, b});
-
-		if (cursor == intersections.end()) {
-			PropertySet new_set;
-			const PropertySet &first = get_value(a);
-			const PropertySet &second = get_value(b);
-
-#ifdef LHF_USE_ORDERED_CONTAINER_FOR_PROPERTY_SETS
-			// The intersection implementation here is adopted from the example
-			// suggested implementation provided for std::set_intersection from
-			// cppreference.com
-			auto cursor_1 = first.begin();
-			const auto &cursor_end_1 = first.end();
-			auto cursor_2 = second.begin();
-			const auto &cursor_end_2 = second.end();
-#else
-			Vector<PropertyT> list_first(first.begin(), first.end());
-			std::sort(list_first.begin(), list_first.end());
-			Vector<PropertyT> list_second(second.begin(), second.end());
-			std::sort(list_second.begin(), list_second.end());
-
-			auto cursor_1 = list_first.begin();
-			const auto &cursor_end_1 = list_first.end();
-			auto cursor_2 = list_second.begin();
-			const auto &cursor_end_2 = list_second.end();
-#endif
-
-			while (cursor_1 != cursor_end_1 && cursor_2 != cursor_end_2)
-			{
-				if (less(*cursor_1,*cursor_2)) {
-					cursor_1++;
+		Index cached;
+
+		if (!intersections.find({a, b}, cached)) {
+			PropertySet new_set = take_scratch();
+			PropertySetView first = get_value(a);
+			PropertySetView second = get_value(b);
+
+			if constexpr (Backend::NATIVE_OPERATIONS) {
+				new_set = PropertySet::set_intersection(first, second);
+			} else if constexpr (ARENA_SETS) {
+				new_set.resize(first.size());
+				if (is_small(first.size(), second.size())) {
+					new_set.resize(
+						simd::scalar_intersection<PropertyT, PropertyLess>(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				} else if (is_skewed(first.size(), second.size())) {
+					// Search for each element of the smaller set in the larger one.
+					PropertySetView small = first.size() < second.size() ? first : second;
+					PropertySetView large = first.size() < second.size() ? second : first;
+					new_set.resize(
+						simd::gallop_intersection<PropertyT, PropertyLess>(
+							small.data(), small.size(),
+							large.data(), large.size(),
+							new_set.data()));
 				} else {
-					if (!(less(*cursor_2, *cursor_1))) {
-						LHF_PUSH_ONE(new_set, *cursor_1);
-						cursor_1++;
+					new_set.resize(
+						SortedKernels::set_intersection(
+							first.data(), first.size(),
+							second.data(), second.size(),
+							new_set.data()));
+				}
+			} else {
+				// The intersection implementation here is adopted from the
+				// example suggested implementation provided for
+				// std::set_intersection from cppreference.com
+				auto intersect = [&](auto cursor_1, auto cursor_end_1, auto cursor_2, auto cursor_end_2) {
+					while (cursor_1 != cursor_end_1 && cursor_2 != cursor_end_2)
+					{
+						if (less(*cursor_1,*cursor_2)) {
+							cursor_1++;
+						} else {
+							if (!(less(*cursor_2, *cursor_1))) {
+								LHF_PUSH_ONE(new_set, *cursor_1);
+								cursor_1++;
+							}
+							cursor_2++;
+						}
 					}
-					cursor_2++;
+				};
+
+				if constexpr (Backend::ORDERED) {
+					intersect(first.begin(), first.end(), second.begin(), second.end());
+				} else {
+					Vector<PropertyT> list_first(first.begin(), first.end());
+					std::sort(list_first.begin(), list_first.end());
+					Vector<PropertyT> list_second(second.begin(), second.end());
+					std::sort(list_second.begin(), list_second.end());
+
+					intersect(
+						list_first.begin(), list_first.end(),
+						list_second.begin(), list_second.end());
 				}
 			}
 
 			bool cold = false;
-			Index ret = register_set(new_set, cold);
-			intersections.insert({{a, b}, ret});
+			Index ret = intern_result(std::move(new_set), cold);
+			intersections.insert({a, b}, ret);
 
 			if (ret != a) {
 				store_subset(ret, a);
@@ -1105,9 +3433,72 @@ struct LatticeHashForest {
 		}
 
 		LHF_PERF_INC(intersections, hits);
-		return cursor->second;
+		return cached;
+	}
+
+
+	/**
+	 * @brief      Finds the run of a sorted vector set that lies inside the
+	 *             range described by `bound` (see set_filter), by binary
+	 *             searching for both ends of it.
+	 *
+	 * @return     Pointers to the first element of the run and one past its
+	 *             last element.
+	 */
+	template<typename Bound>
+	static std::pair<const PropertyT *, const PropertyT *> bounded_run(
+		const SetView<PropertyT> &s,
+		const Bound &bound) {
+		const PropertyT *begin = std::partition_point(s.begin(), s.end(),
+			[&](const PropertyT &v) { return bound(v) < 0; });
+		const PropertyT *end = std::partition_point(begin, s.end(),
+			[&](const PropertyT &v) { return bound(v) == 0; });
+		return {begin, end};
 	}
 
+	/**
+	 * @brief      Calls `visit` on each element of the set at `s` that lies
+	 *             inside the range described by `bound`, in ascending order
+	 *             for ordered backends. Sorted vector sets find the ends of
+	 *             the range by binary search, and other ordered backends stop
+	 *             at its upper end.
+	 *
+	 * @param[in]  s      The set
+	 * @param[in]  bound  Returns a negative value for elements below the
+	 *                    range, zero for elements in it and a positive value
+	 *                    for elements above it.
+	 * @param[in]  visit  Called with each element in the range.
+	 */
+	template<typename Bound, typename Visit>
+	void for_each_in_range(Index s, const Bound &bound, Visit &&visit) const {
+		if (s == EMPTY_SET) {
+			return;
+		}
+
+		PropertySetView set = get_value(s);
+
+		if constexpr (ARENA_SETS) {
+			auto run = bounded_run(set, bound);
+			for (const PropertyT *v = run.first; v != run.second; v++) {
+				visit(*v);
+			}
+		} else if constexpr (Backend::ORDERED) {
+			for (const PropertyT &v : set) {
+				const auto where = bound(v);
+				if (where > 0) {
+					break;
+				} else if (where == 0) {
+					visit(v);
+				}
+			}
+		} else {
+			for (const PropertyT &v : set) {
+				if (bound(v) == 0) {
+					visit(v);
+				}
+			}
+		}
+	}
 
 	/**
 	 * @brief      Filters a set based on a criterion function.
@@ -1116,22 +3507,24 @@ struct LatticeHashForest {
 	 *             operation rather than letting them implement their own.
 	 *
 	 * @param[in]  s            The set to filter
-	 * @param[in]  filter_func  The filter function (can be a lambda)
+	 * @param[in]  filter_func  The filter function (can be a lambda). It is
+	 *                          called directly, so it can be inlined.
 	 * @param      cache        The cache to use (possibly defined by the user)
 	 *
+	 * @tparam     Func             The type of `filter_func`
 	 * @tparam     is_sort_bounded  Useful for telling the function that the
 	 *                              filter criterion will have a lower and an
-	 *                              upper bound in a sorted list. This can
-	 *                              potentially result in a faster filtering.
-	 *
-	 * @todo Implement sort bound optimization
+	 *                              upper bound in a sorted list. `filter_func`
+	 *                              then describes that range like the `bound`
+	 *                              of for_each_in_range, and sorted vector
+	 *                              sets copy the run inside it as a whole.
 	 *
 	 * @return     Index of the filtered set.
 	 */
 	template <typename Func, bool is_sort_bounded = false>
 	Index set_filter(
 		Index s,
-		std::function<bool(const PropertyT &)> filter_func,
+		const Func &filter_func,
 		HashMap<Index, Index> &cache) {
 		LHF_PROPERTY_SET_INDEX_VALID(s);
 		__lhf_calc_functime();
@@ -1140,32 +3533,422 @@ struct LatticeHashForest {
 			return s;
 		}
 
-		auto cursor = cache.find(s);
+		{
+			LockGuard lock(filter_mutex);
+			auto cursor = cache.find(s);
+
+			if (cursor != cache.end()) {
+				LHF_PERF_INC(filter, hits);
+				return cursor->second;
+			}
+		}
+
+		PropertySet new_set = take_scratch();
+
+		if constexpr (is_sort_bounded && ARENA_SETS) {
+			PropertySetView set = get_value(s);
+			auto run = bounded_run(set, filter_func);
+
+			if (static_cast<std::size_t>(run.second - run.first) == set.size()) {
+				// Everything is in range.
+				LockGuard lock(filter_mutex);
+				cache.insert({s, s});
+				LHF_PERF_INC(filter, equal_hits);
+				return s;
+			}
 
-		if (cursor == cache.end()) {
-			PropertySet new_set;
+			new_set.assign(run.first, run.second);
+		} else if constexpr (is_sort_bounded) {
+			for_each_in_range(s, filter_func, [&](const PropertyT &value) {
+				LHF_PUSH_ONE(new_set, value);
+			});
+		} else {
 			for (PropertyT value : get_value(s)) {
 				if (filter_func(value)) {
 					LHF_PUSH_ONE(new_set, value);
 				}
 			}
+		}
 
-			bool cold;
-			Index new_index = register_set(std::move(new_set), cold);
+		bool cold;
+		Index new_index = intern_result(std::move(new_set), cold);
 
+		{
+			LockGuard lock(filter_mutex);
 			cache.insert({s, new_index});
+		}
 
-			if (cold) {
-				LHF_PERF_INC(filter, cold_misses);
+		if (cold) {
+			LHF_PERF_INC(filter, cold_misses);
+		} else {
+			LHF_PERF_INC(filter, edge_misses);
+		}
+
+		return new_index;
+	}
+
+	/**
+	 * @brief      Drops every set that is not in `roots` (the empty set is
+	 *             always kept), along with every cache entry that mentions a
+	 *             dropped set, and renumbers the survivors. Survivors keep
+	 *             their relative order, so the ordering of cached operand
+	 *             pairs still holds.
+	 *
+	 *             Survivors are copied into a fresh generation of storage,
+	 *             and the previous one (including any loaded snapshot) is
+	 *             released, so the memory of dropped sets is reclaimed too.
+	 *
+	 *             Every index held outside the forest, including those in
+	 *             set_filter caches, must be translated with the returned
+	 *             table. Must not run concurrently with anything else.
+	 *
+	 * @param[in]  roots  The indices of the sets that are still in use.
+	 *
+	 * @return     A table mapping each old index to its new index, or to
+	 *             DROPPED_SET if the set was dropped.
+	 */
+	Vector<Index> compact(const Vector<Index> &roots) {
+		__lhf_calc_functime();
+
+		const std::size_t old_count = property_sets.size();
+		Vector<Index> remap(old_count, DROPPED_SET);
+
+		Vector<bool> live(old_count, false);
+		live[EMPTY_SET] = true;
+		for (Index r : roots) {
+			LHF_PROPERTY_SET_INDEX_VALID(r);
+			live[r] = true;
+		}
+
+		Index live_count = 0;
+		for (Index i = 0; i < old_count; i++) {
+			if (live[i]) {
+				remap[i] = live_count++;
+			}
+		}
+
+		for (PropertySetShard &shard : property_set_shards) {
+			shard.map.clear();
+		}
+
+		// The survivors are read from the old table as they are copied out.
+		PropertySetStorage old_sets;
+		old_sets.swap(property_sets);
+
+		// The survivors still point into the old generation until they are
+		// copied out.
+		Vector<PropertySetArena> old_generation;
+		for (PropertySetShard &shard : property_set_shards) {
+			old_generation.push_back(std::move(shard.arena));
+			shard.arena = PropertySetArena();
+		}
+
+		for (Index i = 0; i < old_count; i++) {
+			if (remap[i] == DROPPED_SET) {
+				continue;
+			}
+
+			const std::size_t hash = old_sets[i].hash;
+			PropertySetShard &shard =
+				property_set_shards[hash % PROPERTY_SET_SHARD_COUNT];
+			Index ret;
+			if constexpr (ARENA_SETS) {
+				PropertySetView old = old_sets[i].set.view();
+				ret = append_property_set(
+					PropertySetEntry::store(old.begin(), old.end(), shard.arena), hash);
 			} else {
-				LHF_PERF_INC(filter, edge_misses);
+				ret = append_property_set(std::move(old_sets[i].set), hash);
+			}
+			PropertySetKey key = {to_ref(get_value(ret)), hash};
+			shard.map.insert(std::make_pair(key, remap[i]));
+		}
+
+		auto remap_result = [&](OperationNode &op, Index &result) {
+			op = {remap[op.left], remap[op.right]};
+			result = remap[result];
+			return op.left != DROPPED_SET && op.right != DROPPED_SET && result != DROPPED_SET;
+		};
+
+		unions.rewrite(remap_result);
+		intersections.rewrite(remap_result);
+		differences.rewrite(remap_result);
+		subsets.rewrite([&](OperationNode &op, SubsetRelation &) {
+			op = {remap[op.left], remap[op.right]};
+			return op.left != DROPPED_SET && op.right != DROPPED_SET;
+		});
+		rebuild_superset_edges();
+
+		for (PropertySetShard &shard : property_set_shards) {
+			for (auto i = shard.singletons.begin(); i != shard.singletons.end(); ) {
+				i->second = remap[i->second];
+				if (i->second == DROPPED_SET) {
+					i = shard.singletons.erase(i);
+				} else {
+					i++;
+				}
+			}
+		}
+
+		NaryOperationMap old_unions_many = std::move(unions_many);
+		unions_many = NaryOperationMap();
+		for (auto &i : old_unions_many) {
+			Vector<Index> ops = i.first;
+			bool kept = remap[i.second] != DROPPED_SET;
+			for (Index &op : ops) {
+				op = remap[op];
+				kept = kept && op != DROPPED_SET;
 			}
 
-			return new_index;
+			if (kept) {
+				unions_many.insert({std::move(ops), remap[i.second]});
+			}
 		}
 
-		LHF_PERF_INC(filter, hits);
-		return cursor->second;
+		snapshot.reset();
+		return remap;
+	}
+
+	/**
+	 * @brief      Writes every interned set and the operation caches to a
+	 *             snapshot file (see SnapshotHeader for the layout). Must not
+	 *             run concurrently with operations that add to the forest.
+	 *
+	 * @param[in]  path  The file to write.
+	 */
+	void save(const String &path) const {
+		static_assert(std::is_trivially_copyable<PropertyT>::value,
+			"Only forests of trivially copyable properties can be saved");
+		__lhf_calc_functime();
+
+		const std::size_t set_count = property_sets.size();
+
+		Vector<std::uint64_t> hashes(set_count);
+		for (Index i = 0; i < set_count; i++) {
+			hashes[i] = hash_of(i);
+		}
+
+		Vector<std::uint64_t> offsets(set_count + 1);
+		offsets[0] = 0;
+		for (Index i = 0; i < set_count; i++) {
+			offsets[i + 1] = offsets[i] + get_value(i).size();
+		}
+
+		SnapshotHeader h = {};
+		std::memcpy(h.magic, SnapshotHeader::magic_string(), sizeof(h.magic));
+		h.version = SnapshotHeader::VERSION;
+		h.endian_mark = SnapshotHeader::ENDIAN_MARK;
+		h.backend = static_cast<std::uint32_t>(BACKEND);
+		h.property_size = sizeof(PropertyT);
+		h.shard_count = PROPERTY_SET_SHARD_COUNT;
+		h.set_count = set_count;
+		h.element_count = offsets[set_count];
+
+		SnapshotWriter w(path);
+		w.write(h);
+		w.align();
+		w.write(hashes.data(), hashes.size() * sizeof(std::uint64_t));
+		w.write(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+
+		for (Index i = 0; i < set_count; i++) {
+			for (const PropertyT &v : get_value(i)) {
+				w.write(v);
+			}
+		}
+		w.align();
+
+		unions.save(w);
+		intersections.save(w);
+		differences.save(w);
+		subsets.save(w);
+		w.close();
+	}
+
+	/**
+	 * @brief      Restores a forest written by save(). The file is mapped and
+	 *             used in place: sorted vector sets are views into the
+	 *             mapping, the property set map is rebuilt from the stored
+	 *             hashes, and the cache tables are copied without rehashing.
+	 *             Sets interned afterwards go to the arena as usual.
+	 *
+	 *             The forest must not contain anything but the empty set,
+	 *             and the snapshot must have been written with the same
+	 *             property type and backend.
+	 *
+	 * @param[in]  path  The file to read.
+	 */
+	void load(const String &path) {
+		static_assert(std::is_trivially_copyable<PropertyT>::value,
+			"Only forests of trivially copyable properties can be loaded");
+		__lhf_calc_functime();
+
+		if (property_sets.size() != 1) {
+			throw SnapshotError("Snapshots can only be loaded into an empty forest");
+		}
+
+		UniquePointer<MappedFile> file(new MappedFile(path));
+		SnapshotReader r(*file);
+		const SnapshotHeader h = r.read<SnapshotHeader>();
+
+		if (std::memcmp(h.magic, SnapshotHeader::magic_string(), sizeof(h.magic)) != 0 ||
+			h.endian_mark != SnapshotHeader::ENDIAN_MARK) {
+			throw SnapshotError("Not a snapshot, or written on a different platform: " + path);
+		}
+
+		if (h.version != SnapshotHeader::VERSION ||
+			h.backend != static_cast<std::uint32_t>(BACKEND) ||
+			h.property_size != sizeof(PropertyT) ||
+			h.shard_count == 0 ||
+			h.set_count == 0) {
+			throw SnapshotError("Snapshot does not match this forest: " + path);
+		}
+
+		const std::uint64_t *hashes = r.take<std::uint64_t>(h.set_count);
+		const std::uint64_t *offsets = r.take<std::uint64_t>(h.set_count + 1);
+		const PropertyT *elements = r.take<PropertyT>(h.element_count);
+
+		// The whole file is checked before anything is added to the forest,
+		// which stays empty if the snapshot is rejected.
+		// Set 0 must be the empty set, sets of ordered backends must be
+		// strictly ascending, every stored hash must be the hash of its set,
+		// and no set may be stored twice, or they would not match the sets
+		// interned later.
+		if (offsets[0] != 0 || offsets[1] != 0) {
+			throw SnapshotError("Snapshot has malformed set offsets");
+		}
+		const auto same_set = [&](Index a, Index b) {
+			const PropertyT *begin = elements + offsets[a];
+			const PropertyT *end = elements + offsets[a + 1];
+			const PropertyT *other = elements + offsets[b];
+			if (end - begin != elements + offsets[b + 1] - other) {
+				return false;
+			}
+			if constexpr (Backend::ORDERED) {
+				return std::equal(begin, end, other, PropertyEqual());
+			} else {
+				return std::is_permutation(begin, end, other, PropertyEqual());
+			}
+		};
+		// Indices of the sets checked so far, by hash. The empty set hashes
+		// to 0.
+		HashMap<std::uint64_t, Vector<Index>> seen = {{0, {EMPTY_SET}}};
+		for (Index i = 1; i < h.set_count; i++) {
+			if (offsets[i] > offsets[i + 1] || offsets[i + 1] > h.element_count) {
+				throw SnapshotError("Snapshot has malformed set offsets");
+			}
+			if constexpr (Backend::ORDERED) {
+				for (std::uint64_t j = offsets[i] + 1; j < offsets[i + 1]; j++) {
+					if (!PropertyLess()(elements[j - 1], elements[j])) {
+						throw SnapshotError("Snapshot has a set out of order");
+					}
+				}
+			}
+			const std::size_t hash = PropertySetHash::hash_range(
+				elements + offsets[i], elements + offsets[i + 1]);
+			if (hashes[i] != static_cast<std::uint64_t>(hash)) {
+				throw SnapshotError("Snapshot has a set whose hash does not match it");
+			}
+			Vector<Index> &candidates = seen[hashes[i]];
+			for (Index j : candidates) {
+				if (same_set(i, j)) {
+					throw SnapshotError("Snapshot has a set stored twice");
+				}
+			}
+			candidates.push_back(i);
+		}
+
+		const auto valid_index = [&](const OperationNode &, std::uint64_t v) {
+			return v < h.set_count;
+		};
+		// Relations are only ever cached in index order (see store_subset).
+		const auto valid_relation = [](const OperationNode &op, std::uint64_t v) {
+			return op.left < op.right &&
+				(v == SUBSET || v == SUPERSET || v == INCOMPARABLE);
+		};
+		const auto union_tables =
+			BinaryOperationMap::read_tables(r, h.shard_count, h.set_count, valid_index);
+		const auto intersection_tables =
+			BinaryOperationMap::read_tables(r, h.shard_count, h.set_count, valid_index);
+		const auto difference_tables =
+			BinaryOperationMap::read_tables(r, h.shard_count, h.set_count, valid_index);
+		const auto subset_tables =
+			ShardedOperationMap<SubsetRelation>::read_tables(r, h.shard_count, h.set_count, valid_relation);
+
+		// Index 0 is the empty set, which is already present.
+		for (Index i = 1; i < h.set_count; i++) {
+			const PropertyT *begin = elements + offsets[i];
+			const PropertyT *end = elements + offsets[i + 1];
+
+			if constexpr (ARENA_SETS) {
+				append_property_set(PropertySetEntry::refer(begin, end - begin), hashes[i]);
+			} else {
+				PropertySet *stored = new PropertySet();
+				for (const PropertyT *v = begin; v != end; v++) {
+					LHF_PUSH_ONE(*stored, *v);
+				}
+				append_property_set(PropertySetEntry(stored), hashes[i]);
+			}
+			PropertySetKey key = {to_ref(get_value(i)), hashes[i]};
+			property_set_shards[key.hash % PROPERTY_SET_SHARD_COUNT].map.insert(
+				std::make_pair(key, i));
+		}
+
+		unions.load(union_tables);
+		intersections.load(intersection_tables);
+		differences.load(difference_tables);
+		subsets.load(subset_tables);
+		rebuild_superset_edges();
+
+		snapshot = std::move(file);
+	}
+
+	/**
+	 * @brief      Reports the memory held by the forest, broken down by
+	 *             structure. Container overheads are estimated (see
+	 *             heap_bytes). Treap forests are charged for the whole node
+	 *             table, which they share with every other forest of the same
+	 *             property type.
+	 */
+	MemoryUsage memory_usage() const {
+		MemoryUsage m;
+
+		for (const PropertySetShard &shard : property_set_shards) {
+			LockGuard lock(shard.mutex);
+			m.property_set_map += heap_bytes(shard.map) + heap_bytes(shard.singletons);
+
+			if constexpr (ARENA_SETS) {
+				m.set_payload += shard.arena.memory_usage();
+			} else {
+				for (const auto &entry : shard.map) {
+					m.set_payload += sizeof(PropertySet) + heap_bytes(*entry.first.set);
+				}
+			}
+		}
+
+		if constexpr (BACKEND == BackendKind::TREAP) {
+			m.set_payload += PropertySet::node_memory_usage();
+		}
+
+		m.set_overhead = heap_bytes(property_sets);
+		m.unions = unions.memory_usage();
+		m.intersections = intersections.memory_usage();
+		m.differences = differences.memory_usage();
+		m.subsets = subsets.memory_usage();
+
+		{
+			LockGuard lock(superset_edges_mutex);
+			m.superset_edges = heap_bytes(superset_edges);
+		}
+
+		{
+			LockGuard lock(unions_many_mutex);
+			m.unions_many = heap_bytes(unions_many);
+		}
+
+		if (snapshot) {
+			m.snapshot = snapshot->size;
+		}
+
+		return m;
 	}
 
 	String dump() {
@@ -1173,50 +3956,131 @@ struct LatticeHashForest {
 		s << "LatticeHashForest {\n";
 
 		s << "    " << "Unions: " << "(Count: " << unions.size() << ")\n";
-		for (auto i : unions) {
+		unions.for_each([&](const std::pair<OperationNode, Index> &i) {
 			s << "      {" << i.first << " -> " << i.second << "} \n";
-		}
+		});
 
 		s << "\n";
 		s << "    " << "Differences:" << "(Count: " << differences.size() << ")\n";
-		for (auto i : differences) {
+		differences.for_each([&](const std::pair<OperationNode, Index> &i) {
 			s << "      {" << i.first << " -> " << i.second << "} \n";
-		}
+		});
 
 		s << "\n";
 		s << "    " << "Intersections: " << "(Count: " << intersections.size() << ")\n";
-		for (auto i : intersections) {
+		intersections.for_each([&](const std::pair<OperationNode, Index> &i) {
 			s << "      {" << i.first << " -> " << i.second << "} \n";
-		}
+		});
 
 		s << "\n";
 		s << "    " << "Subsets: " << "(Count: " << subsets.size() << ")\n";
-		for (auto i : subsets) {
-			s << "      " << i.first << " -> " << (i.second == SUBSET ? "sub" : "sup") << "\n";
-		}
+		subsets.for_each([&](const std::pair<OperationNode, SubsetRelation> &i) {
+			s << "      " << i.first << " -> "
+			  << (i.second == SUBSET ? "sub" : i.second == SUPERSET ? "sup" : "none") << "\n";
+		});
 
 		s << "\n";
-		s << "    " << "PropertySets: " << "(Count: " << property_set_map.size() << ")\n";
-		for (auto i : property_set_map) {
-			s << "      " << i.second << " : " << ptr_container_to_string(property_sets[i.second]) << "\n";
+		s << "    " << "PropertySets: " << "(Count: " << property_sets.size() << ")\n";
+		for (PropertySetShard &shard : property_set_shards) {
+			LockGuard lock(shard.mutex);
+			for (auto i : shard.map) {
+				s << "      " << i.second << " : " << container_to_string(get_value(i.second)) << "\n";
+			}
 		}
 		s << "}\n";
 		return s.str();
 	}
 
 #ifdef LHF_ENABLE_PERFORMANCE_METRICS
+	// Copies the eviction counters kept by a cache into its OperationPerf.
+	template<typename V>
+	void collect_cache_perf(const String &name, const ShardedOperationMap<V> &cache) {
+		if (cache.evictions() == 0) {
+			return;
+		}
+
+		OperationPerf &p = perf_of(perf_id(name));
+		p.evictions = cache.evictions();
+		p.rederivations = cache.rederivations();
+	}
+
 	String dump_perf() {
 		std::stringstream s;
 		s << "LHF Perf: \n";
-		for (auto &p : perf) {
-			s << p.first << "\n"
-			  << p.second.to_string() << "\n";
+		collect_cache_perf(STR(unions), unions);
+		collect_cache_perf(STR(intersections), intersections);
+		collect_cache_perf(STR(differences), differences);
+		collect_cache_perf(STR(subsets), subsets);
+		{
+			PerfNames &names = perf_names();
+			std::lock_guard<std::mutex> lock(names.mutex);
+			for (std::size_t id = 0; id < perf.size(); id++) {
+				if (perf[id].empty()) {
+					continue;
+				}
+				s << names.names[id] << "\n"
+				  << perf[id].to_string() << "\n";
+			}
 		}
 		s << __stat.dump();
 		return s.str();
 	}
 #endif
 
+	/**
+	 * @brief      Writes the size of the forest as members of the object open
+	 *             in `w`: "total_sets" and "memory" (see memory_usage()). With
+	 *             LHF_ENABLE_PERFORMANCE_METRICS, also the statistics of every
+	 *             operation, under "operations".
+	 */
+	void write_perf_json(JsonWriter &w) {
+		w.value("total_sets", property_sets.size());
+		w.begin_object("memory");
+		memory_usage().write_json(w);
+		w.end_object();
+
+#ifdef LHF_ENABLE_PERFORMANCE_METRICS
+		collect_cache_perf(STR(unions), unions);
+		collect_cache_perf(STR(intersections), intersections);
+		collect_cache_perf(STR(differences), differences);
+		collect_cache_perf(STR(subsets), subsets);
+
+		w.begin_object("operations");
+		{
+			PerfNames &names = perf_names();
+			std::lock_guard<std::mutex> lock(names.mutex);
+			for (std::size_t id = 0; id < perf.size(); id++) {
+				if (perf[id].empty()) {
+					continue;
+				}
+				w.begin_object(names.names[id]);
+				perf[id].write_json(w);
+				w.end_object();
+			}
+		}
+		w.end_object();
+#endif
+	}
+
+	/**
+	 * @brief      The machine-readable counterpart of dump_perf(): a JSON
+	 *             document of write_perf_json(), with the profiler statistics
+	 *             (PerformanceStatistics::write_json) under "profiler" when
+	 *             the profiler is enabled.
+	 */
+	String dump_perf_json() {
+		JsonWriter w;
+		w.begin_object();
+		write_perf_json(w);
+#ifdef LHF_ENABLE_PROFILER
+		w.begin_object("profiler");
+		__stat.write_json(w);
+		w.end_object();
+#endif
+		w.end_object();
+		return w.str();
+	}
+
 
 	LatticeHashForest() {
 		// INSERT EMPTY SET AT INDEX 0
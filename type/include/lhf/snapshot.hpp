@@ -0,0 +1,223 @@
+#ifndef LHF_SNAPSHOT_HPP
+#define LHF_SNAPSHOT_HPP
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LHF_SNAPSHOT_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lhf {
+
+/**
+ * @brief      On-disk layout of a LatticeHashForest snapshot.
+ *
+ *             A snapshot is a header followed by sections, each starting on
+ *             an 8-byte boundary:
+ *
+ *             * `uint64 hashes[set_count]`: the hash of every set.
+ *             * `uint64 offsets[set_count + 1]`: set `i` is the element run
+ *               `[offsets[i], offsets[i + 1])`.
+ *             * `PropertyT elements[element_count]`: all sets back to back.
+ *             * The union, intersection, difference and subset caches. For
+ *               each of them, for each shard: `uint64 capacity`,
+ *               `uint64 count`, then `capacity` (key, value) `uint64` pairs,
+ *               which is the shard's probe table slot for slot.
+ *
+ *             Everything is stored in native byte order, so a snapshot can
+ *             be mapped and used in place. Sorted vector sets point straight
+ *             into the mapping, and cache tables are copied without being
+ *             rehashed.
+ */
+struct SnapshotHeader {
+	static const constexpr std::uint32_t VERSION = 2;
+	static const constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t endian_mark;
+
+	// Which property set backend wrote this (see LatticeHashForest::BACKEND).
+	std::uint32_t backend;
+	std::uint32_t property_size;
+
+	std::uint32_t shard_count;
+	std::uint32_t reserved;
+
+	std::uint64_t set_count;
+	std::uint64_t element_count;
+
+	// Identifies the file type, including the terminating NUL.
+	static inline const char *magic_string() {
+		return "LHFSNAP";
+	}
+};
+
+/**
+ * @brief      Thrown when a snapshot cannot be written, read, or does not
+ *             match the forest it is being loaded into.
+ */
+struct SnapshotError : public std::runtime_error {
+	SnapshotError(const std::string &message):
+		std::runtime_error(message.c_str()) {}
+};
+
+/**
+ * @brief      Appends sections to a snapshot file.
+ */
+struct SnapshotWriter {
+	std::ofstream out;
+	std::uint64_t offset = 0;
+
+	SnapshotWriter(const std::string &path):
+		out(path, std::ios::binary | std::ios::trunc) {
+		if (!out) {
+			throw SnapshotError("Cannot open snapshot for writing: " + path);
+		}
+	}
+
+	void write(const void *data, std::size_t bytes) {
+		out.write(static_cast<const char *>(data), bytes);
+		offset += bytes;
+	}
+
+	template<typename T>
+	void write(const T &value) {
+		write(&value, sizeof(T));
+	}
+
+	// Pads the file up to the next 8-byte boundary.
+	void align() {
+		static const char zeros[8] = {};
+		write(zeros, (8 - offset % 8) % 8);
+	}
+
+	void close() {
+		out.close();
+		if (!out) {
+			throw SnapshotError("Failed to write snapshot");
+		}
+	}
+};
+
+/**
+ * @brief      A read-only view of a whole file. The file is memory-mapped
+ *             where the platform allows it, and read into memory otherwise.
+ *             The contents stay valid for the lifetime of this object.
+ */
+struct MappedFile {
+	const char *data = nullptr;
+	std::size_t size = 0;
+
+#ifdef LHF_SNAPSHOT_MMAP
+	MappedFile(const std::string &path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw SnapshotError("Cannot open snapshot: " + path);
+		}
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw SnapshotError("Cannot stat snapshot: " + path);
+		}
+
+		size = static_cast<std::size_t>(st.st_size);
+		if (size > 0) {
+			void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				throw SnapshotError("Cannot map snapshot: " + path);
+			}
+			data = static_cast<const char *>(p);
+		}
+		::close(fd);
+	}
+
+	~MappedFile() {
+		if (data != nullptr) {
+			::munmap(const_cast<char *>(data), size);
+		}
+	}
+#else
+	std::vector<std::uint64_t> buffer;
+
+	MappedFile(const std::string &path) {
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		if (!in) {
+			throw SnapshotError("Cannot open snapshot: " + path);
+		}
+
+		size = static_cast<std::size_t>(in.tellg());
+		// Backed by 64-bit words so that the sections stay aligned.
+		buffer.resize((size + 7) / 8);
+		in.seekg(0);
+		in.read(reinterpret_cast<char *>(buffer.data()), size);
+		if (!in) {
+			throw SnapshotError("Cannot read snapshot: " + path);
+		}
+		data = reinterpret_cast<const char *>(buffer.data());
+	}
+#endif
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+};
+
+/**
+ * @brief      Walks the sections of a mapped snapshot, checking that every
+ *             section lies within the file.
+ */
+struct SnapshotReader {
+	const char *data;
+	std::size_t size;
+	std::size_t offset = 0;
+
+	SnapshotReader(const MappedFile &file): data(file.data), size(file.size) {}
+
+	/**
+	 * @brief      Takes `n` contiguous values of type T at the current
+	 *             position, and moves past them (and any padding after them).
+	 *
+	 * @return     Pointer to the first value, inside the mapping.
+	 */
+	template<typename T>
+	const T *take(std::size_t n) {
+		if (n > (size - offset) / sizeof(T)) {
+			throw SnapshotError("Snapshot is truncated");
+		}
+
+		const T *ret = reinterpret_cast<const T *>(data + offset);
+		offset += n * sizeof(T);
+		offset += (8 - offset % 8) % 8;
+		if (offset > size) {
+			offset = size;
+		}
+		return ret;
+	}
+
+	// Bytes left after the current position.
+	std::size_t remaining() const {
+		return size - offset;
+	}
+
+	template<typename T>
+	T read() {
+		T ret;
+		std::memcpy(&ret, take<T>(1), sizeof(T));
+		return ret;
+	}
+};
+
+}
+
+#endif
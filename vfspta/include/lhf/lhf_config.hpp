@@ -1,9 +1,15 @@
 #ifndef LHF_CONFIG_HPP
 #define LHF_CONFIG_HPP
 
+// The LHF_USE_*_FOR_PROPERTY_SETS options pick the property set backend of
+// forests that do not name one as their Backend parameter (see
+// lhf::DefaultBackend). The default is sorted vectors.
+
 #if !defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS) && \
 	!defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS) && \
-	!defined(LHF_USE_HASH_TABLE_FOR_PROPERTY_SETS)
+	!defined(LHF_USE_HASH_TABLE_FOR_PROPERTY_SETS) && \
+	!defined(LHF_USE_BITMAP_FOR_PROPERTY_SETS) && \
+	!defined(LHF_USE_TREAP_FOR_PROPERTY_SETS)
 #define LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS
 #endif
 
@@ -12,11 +18,102 @@
 #error "Ordered Set and Sorted Vector options are mutually exclusive"
 #endif
 
-#if defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS) || \
-	defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS)
-#define LHF_USE_ORDERED_CONTAINER_FOR_PROPERTY_SETS
+#if defined(LHF_USE_BITMAP_FOR_PROPERTY_SETS) && \
+	(defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS) || \
+	 defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS) || \
+	 defined(LHF_USE_HASH_TABLE_FOR_PROPERTY_SETS))
+#error "Bitmap option is mutually exclusive with the other property set options"
+#endif
+
+#if defined(LHF_USE_TREAP_FOR_PROPERTY_SETS) && \
+	(defined(LHF_USE_ORDERED_SET_FOR_PROPERTY_SETS) || \
+	 defined(LHF_USE_SORTED_VECTOR_FOR_PROPERTY_SETS) || \
+	 defined(LHF_USE_HASH_TABLE_FOR_PROPERTY_SETS) || \
+	 defined(LHF_USE_BITMAP_FOR_PROPERTY_SETS))
+#error "Treap option is mutually exclusive with the other property set options"
 #endif
 
 #define LHF_SORTED_VECTOR_BINARY_SEARCH_THRESHOLD 12
 
+// Sorted vector intersections and differences switch from a linear merge to
+// galloping search once one operand is this many times larger than the other.
+#ifndef LHF_GALLOPING_SIZE_RATIO
+#define LHF_GALLOPING_SIZE_RATIO 32
+#endif
+
+// Most sets that is_subset_of visits when inferring a subset relation
+// transitively from known ones, before falling back to comparing elements.
+#ifndef LHF_SUBSET_INFERENCE_LIMIT
+#define LHF_SUBSET_INFERENCE_LIMIT 64
+#endif
+
+// Memory budget in bytes for each of the union, intersection, difference and
+// subset caches, or 0 for no limit. A full cache evicts entries it has not
+// used recently (CLOCK). The budget can also be changed per cache at runtime
+// with set_budget().
+#ifndef LHF_OPERATION_CACHE_BUDGET
+#define LHF_OPERATION_CACHE_BUDGET 0
+#endif
+
+// Most distinct timer names, and separately counter names, that the profiler
+// (LHF_ENABLE_PERFORMANCE_METRICS) can track. Every thread that records keeps
+// an array of this size.
+#ifndef LHF_PROFILER_MAX_IDS
+#define LHF_PROFILER_MAX_IDS 256
+#endif
+
+// Define LHF_ENABLE_TRACING to record every timed call of the profiler as a
+// Chrome trace event (see PerformanceStatistics::writeTrace). This turns on
+// the profiler, but not the operation statistics of
+// LHF_ENABLE_PERFORMANCE_METRICS, so it may be combined with concurrency.
+// Define LHF_ENABLE_HARDWARE_COUNTERS to also count cycles, instructions, last
+// level cache misses and branch misses in every timed scope of the profiler,
+// through Linux perf_event_open. Counters that cannot be opened (not Linux,
+// kernel.perf_event_paranoid, no PMU in a virtual machine) are reported as
+// unavailable. Reading the counters takes a system call at both ends of a
+// scope. Like tracing, this turns on the profiler.
+
+#if defined(LHF_ENABLE_PERFORMANCE_METRICS) || defined(LHF_ENABLE_TRACING) || \
+	defined(LHF_ENABLE_HARDWARE_COUNTERS)
+#define LHF_ENABLE_PROFILER
+#endif
+
+// Number of calls each thread keeps for the trace. Once a thread has made more
+// timed calls than this, its oldest ones are overwritten.
+#ifndef LHF_TRACE_BUFFER_EVENTS
+#define LHF_TRACE_BUFFER_EVENTS 262144
+#endif
+
+// Define LHF_DISABLE_SIMD to always use the scalar merge kernels for sorted
+// vector property sets. Otherwise vector kernels are selected at runtime when
+// the CPU supports them.
+
+// Define LHF_ENABLE_CONCURRENCY to make a single forest safe to share between
+// threads. Interning is split over this many independently locked shards, and
+// interned sets are read without locking.
+#ifdef LHF_ENABLE_CONCURRENCY
+#ifndef LHF_CONCURRENT_SHARD_COUNT
+#define LHF_CONCURRENT_SHARD_COUNT 64
+#endif
+
+// The operation statistics are plain (unsynchronized) counters. The profiler
+// itself records per thread.
+#ifdef LHF_ENABLE_PERFORMANCE_METRICS
+#error "Performance metrics are not supported together with concurrency"
+#endif
+#endif
+
+// Size in bytes of an entry of the sorted vector property set index table
+// (at least 16). Sets that fit in an entry are stored inline instead of in the
+// arena; raising this lets larger sets be stored inline.
+#ifndef LHF_INLINE_SET_BYTES
+#define LHF_INLINE_SET_BYTES 16
+#endif
+
+// Number of elements in each slab of the sorted vector property set arena.
+// Sets larger than this get a slab of their own.
+#ifndef LHF_ARENA_SLAB_SIZE
+#define LHF_ARENA_SLAB_SIZE 65536
+#endif
+
 #endif
\ No newline at end of file
@@ -1,78 +1,843 @@
 #ifndef LHF_PROFILING_H
 #define LHF_PROFILING_H
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include "lhf_config.hpp"
+#include "json.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define LHF_PROFILING_RDTSC
+#include <x86intrin.h>
+#endif
+
+#if defined(LHF_ENABLE_HARDWARE_COUNTERS) && defined(__linux__)
+#define LHF_PROFILING_PERF_EVENTS
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 namespace lhf {
 
+/**
+ * @brief      Reads a cheap, monotonic tick counter: the time stamp counter on
+ *             x86, and steady_clock elsewhere. PerformanceStatistics converts
+ *             ticks to time when it reports them.
+ */
+inline std::uint64_t read_cycle_counter() {
+#ifdef LHF_PROFILING_RDTSC
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/**
+ * @brief      The hardware counters of the calling thread (cycles,
+ *             instructions, last level cache misses, branch misses), opened as
+ *             one perf_event_open group and read with a single system call.
+ *
+ *             Counters that cannot be opened stay unavailable and read as
+ *             zero, and error() tells why; nothing else is affected. Only
+ *             user space is counted. When the PMU is shared (the group is
+ *             multiplexed), the counts of an interval are scaled up by the
+ *             share of that interval the group was counting. A group that is
+ *             never scheduled at all is unavailable.
+ */
+class HardwareCounters {
+public:
+	static constexpr std::size_t COUNT = 4;
+	using Values = std::uint64_t[COUNT];
+
+	static const char *name(std::size_t counter) {
+		static const char *const names[COUNT] = {
+			"cycles", "instructions", "llc_misses", "branch_misses"
+		};
+		return names[counter];
+	}
+
+private:
+	int leader = -1;
+	int fds[COUNT] = {-1, -1, -1, -1};
+
+	// Position of each open counter in what reading the group returns, or -1
+	int positions[COUNT] = {-1, -1, -1, -1};
+	std::size_t opened = 0;
+
+	std::string failure;
+
+	// Whether read() has read the group, and whether the group had been
+	// scheduled by then. Atomic since aggregate() reads them from other
+	// threads.
+	mutable std::atomic<bool> was_read = {false};
+	mutable std::atomic<bool> was_scheduled = {false};
+
+	bool unscheduled() const {
+		return was_read.load(std::memory_order_relaxed) &&
+			!was_scheduled.load(std::memory_order_relaxed);
+	}
+
+public:
+	HardwareCounters() {
+#ifdef LHF_PROFILING_PERF_EVENTS
+		static const std::uint64_t configs[COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		for (std::size_t i = 0; i < COUNT; i++) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.read_format = PERF_FORMAT_GROUP |
+				PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			// This thread, on any CPU. The first counter that opens leads
+			// the group.
+			const int fd = static_cast<int>(syscall(
+				SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+
+			if (fd < 0) {
+				if (failure.empty()) {
+					failure = std::string("perf_event_open (") + name(i) + "): " + std::strerror(errno);
+				}
+				continue;
+			}
+
+			if (leader < 0) {
+				leader = fd;
+			}
+			fds[i] = fd;
+			positions[i] = static_cast<int>(opened++);
+		}
+#else
+		failure = "perf_event_open is only available on Linux";
+#endif
+	}
+
+	HardwareCounters(const HardwareCounters &) = delete;
+	HardwareCounters &operator=(const HardwareCounters &) = delete;
+
+	~HardwareCounters() { close(); }
+
+	/**
+	 * @brief      Closes the counters, which read as zero afterwards. Whether
+	 *             they were available is still reported.
+	 */
+	void close() {
+#ifdef LHF_PROFILING_PERF_EVENTS
+		for (int &fd : fds) {
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+		}
+#endif
+		leader = -1;
+		opened = 0;
+	}
+
+	bool available(std::size_t counter) const {
+		return positions[counter] >= 0 && !unscheduled();
+	}
+
+	// Why a counter is unavailable, or empty if all of them are available.
+	std::string error() const {
+		if (failure.empty() && unscheduled()) {
+			return "the counters were never scheduled on the PMU";
+		}
+		return failure;
+	}
+
+	/**
+	 * @brief      The raw state of the group at one point: the cumulative
+	 *             counts and the times it was enabled and running. Readings
+	 *             are only meaningful as the two ends of a delta().
+	 */
+	struct Reading {
+		bool valid = false;
+		std::uint64_t enabled = 0;
+		std::uint64_t running = 0;
+		Values counts = {};
+	};
+
+	inline void read(Reading &reading) const {
+		// The group reads as its size, the times it was enabled and running,
+		// then its counters.
+		std::uint64_t group[COUNT + 3] = {};
+
+#ifdef LHF_PROFILING_PERF_EVENTS
+		if (opened > 0 && ::read(leader, group, sizeof(group)) < 0) {
+			group[0] = 0;
+		}
+#endif
+
+		reading.valid = group[0] != 0;
+		reading.enabled = group[1];
+		reading.running = group[2];
+		if (reading.valid) {
+			was_read.store(true, std::memory_order_relaxed);
+			if (reading.running != 0) {
+				was_scheduled.store(true, std::memory_order_relaxed);
+			}
+		}
+
+		for (std::size_t i = 0; i < COUNT; i++) {
+			reading.counts[i] = positions[i] < 0 ? 0 : group[positions[i] + 3];
+		}
+	}
+
+	/**
+	 * @brief      The events of `counter` between two readings. If the group
+	 *             was multiplexed in between, the count is scaled up by the
+	 *             share of that interval it was running. 0 if either read
+	 *             failed or the group never ran in between.
+	 */
+	static inline std::uint64_t delta(const Reading &start, const Reading &end, std::size_t counter) {
+		if (!start.valid || !end.valid ||
+		    end.running <= start.running || end.enabled < start.enabled ||
+		    end.counts[counter] < start.counts[counter]) {
+			return 0;
+		}
+
+		const std::uint64_t count = end.counts[counter] - start.counts[counter];
+		const std::uint64_t enabled = end.enabled - start.enabled;
+		const std::uint64_t running = end.running - start.running;
+		return running < enabled ?
+			static_cast<std::uint64_t>(static_cast<long double>(count) * enabled / running) :
+			count;
+	}
+};
+
+/**
+ * @brief      A log-linear histogram of unsigned values. Each power of two is
+ *             split into SUB_BUCKETS equal buckets, so a percentile it reports
+ *             is at most 1/SUB_BUCKETS above the true one, whatever the
+ *             magnitude of the values. Values below SUB_BUCKETS are exact.
+ */
+struct Histogram {
+	using Count = std::uint64_t;
+
+	static constexpr unsigned SUB_BUCKET_BITS = 3;
+	static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BUCKET_BITS;
+	static constexpr std::size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	// Grown up to the highest bucket used.
+	std::vector<Count> buckets;
+	Count count = 0;
+	std::uint64_t sum = 0;
+	std::uint64_t max = 0;
+
+	static inline std::size_t bucket_of(std::uint64_t value) {
+		if (value < SUB_BUCKETS) {
+			return value;
+		}
+		const unsigned exponent = 63 - __builtin_clzll(value);
+		const unsigned shift = exponent - SUB_BUCKET_BITS;
+		return ((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	// The largest value that falls into `bucket`.
+	static inline std::uint64_t bucket_limit(std::size_t bucket) {
+		if (bucket < SUB_BUCKETS) {
+			return bucket;
+		}
+		const unsigned shift = (bucket >> SUB_BUCKET_BITS) - 1;
+		const std::uint64_t lowest = std::uint64_t(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+		return lowest + ((std::uint64_t(1) << shift) - 1);
+	}
+
+	void add(std::size_t bucket, Count n) {
+		if (bucket >= buckets.size()) {
+			buckets.resize(bucket + 1);
+		}
+		buckets[bucket] += n;
+	}
+
+	void record(std::uint64_t value) {
+		add(bucket_of(value), 1);
+		count++;
+		sum += value;
+		max = std::max(max, value);
+	}
+
+	/**
+	 * @brief      The value below or at which `p` percent of the recorded
+	 *             values lie, as the upper limit of its bucket (but never
+	 *             above the largest value recorded). 0 if nothing was
+	 *             recorded.
+	 */
+	std::uint64_t percentile(double p) const {
+		if (count == 0) {
+			return 0;
+		}
+
+		Count rank = static_cast<Count>(std::ceil(p / 100 * count));
+		rank = std::min(std::max(rank, Count(1)), count);
+
+		Count seen = 0;
+		for (std::size_t b = 0; b < buckets.size(); b++) {
+			seen += buckets[b];
+			if (seen >= rank) {
+				return std::min(bucket_limit(b), max);
+			}
+		}
+		return max;
+	}
+
+	long double mean() const {
+		return count == 0 ? 0 : static_cast<long double>(sum) / count;
+	}
+
+	/**
+	 * @brief      One line summary of the distribution. Values are multiplied
+	 *             by `scale` (for example to convert ticks to time).
+	 */
+	std::string to_string(long double scale = 1, const std::string &unit = "") const {
+		std::stringstream s;
+		s << "n " << count
+		  << ", mean " << mean() * scale << unit
+		  << ", p50 " << percentile(50) * scale << unit
+		  << ", p90 " << percentile(90) * scale << unit
+		  << ", p99 " << percentile(99) * scale << unit
+		  << ", max " << max * scale << unit;
+		return s.str();
+	}
+
+	/**
+	 * @brief      Writes the same summary as members of the object open in
+	 *             `w`.
+	 */
+	void write_json(JsonWriter &w, long double scale = 1) const {
+		w.value("count", count)
+		 .value("mean", mean() * scale)
+		 .value("p50", percentile(50) * scale)
+		 .value("p90", percentile(90) * scale)
+		 .value("p99", percentile(99) * scale)
+		 .value("max", max * scale);
+	}
+};
+
+/**
+ * @brief      Timers and counters for profiling builds.
+ *
+ *             Names are interned into small integer IDs once (the profiling
+ *             macros do it once per call site), and each thread records into
+ *             flat arrays indexed by ID. Starting and stopping a timer is then
+ *             two reads of the tick counter and a few stores to memory that no
+ *             other thread writes. The per-thread figures are only summed up,
+ *             and ticks converted to milliseconds, by aggregate() and dump().
+ *
+ *             Besides its total, each timer keeps a histogram of the
+ *             duration of single calls, so that the tail (p99, max) is seen
+ *             and not just the average. Value histograms (__lhf_record) do
+ *             the same for arbitrary quantities, such as set sizes.
+ *
+ *             With LHF_ENABLE_TRACING, each thread also keeps its most recent
+ *             timed calls (when, how long, and optionally the operands) in a
+ *             ring buffer, which writeTrace() writes out in the Chrome
+ *             trace event format.
+ *
+ *             With LHF_ENABLE_HARDWARE_COUNTERS, each timer also sums the
+ *             hardware events (see HardwareCounters) of its calls.
+ */
 struct PerformanceStatistics {
 	using Count = uint64_t;
 	using String = std::string;
-	using TimePoint = std::chrono::steady_clock::time_point;
+	using Id = std::uint32_t;
 	template <typename K, typename V> using Map = std::map<K, V>;
 
+	/**
+	 * @brief      Aggregated figures of one timer.
+	 */
 	struct Duration {
-		bool started = false;
-		TimePoint t1;
-		TimePoint t2;
 		long double duration = 0;
+		Count calls = 0;
+
+		// Durations of single calls, in ticks.
+		Histogram latency;
+		long double milliseconds_per_tick = 0;
+
+		long double getCumulativeDurationMilliseconds() const { return duration; }
+
+		long double getPercentileMilliseconds(double p) const {
+			return latency.percentile(p) * milliseconds_per_tick;
+		}
+
+		long double getMaxMilliseconds() const { return latency.max * milliseconds_per_tick; }
+
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		// Hardware events of all calls, indexed like HardwareCounters.
+		HardwareCounters::Values hardware = {};
+#endif
+	};
+
+	/**
+	 * @brief      A histogram as recorded by one thread. Like TimerSlot, its
+	 *             figures are atomic only to be read by aggregate().
+	 */
+	struct ThreadHistogram {
+		std::atomic<Count> buckets[Histogram::BUCKETS] = {};
+		std::atomic<Count> count = {0};
+		std::atomic<std::uint64_t> sum = {0};
+		std::atomic<std::uint64_t> max = {0};
+
+		inline void record(std::uint64_t value) {
+			bump(buckets[Histogram::bucket_of(value)], 1);
+			bump(count, 1);
+			bump(sum, value);
+			if (value > max.load(std::memory_order_relaxed)) {
+				max.store(value, std::memory_order_relaxed);
+			}
+		}
+
+		void add_to(Histogram &h) const {
+			for (std::size_t b = 0; b < Histogram::BUCKETS; b++) {
+				const Count n = buckets[b].load(std::memory_order_relaxed);
+				if (n) {
+					h.add(b, n);
+				}
+			}
+			h.count += count.load(std::memory_order_relaxed);
+			h.sum += sum.load(std::memory_order_relaxed);
+			h.max = std::max(h.max, max.load(std::memory_order_relaxed));
+		}
+	};
+
+	// Adds to a figure that only the calling thread writes.
+	static inline void bump(std::atomic<std::uint64_t> &figure, std::uint64_t n) {
+		figure.store(figure.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief      Gets the histogram in `slot`, allocating it on first use.
+	 *             Only the thread owning the slot calls this.
+	 */
+	static ThreadHistogram &histogram(std::atomic<ThreadHistogram *> &slot) {
+		ThreadHistogram *h = slot.load(std::memory_order_relaxed);
+		if (h == nullptr) {
+			h = new ThreadHistogram();
+			slot.store(h, std::memory_order_release);
+		}
+		return *h;
+	}
+
+	/**
+	 * @brief      One timer, as recorded by one thread. `ticks` and `calls`
+	 *             are atomic only so that aggregate() can read them while the
+	 *             thread runs. The thread is their only writer, so updates are
+	 *             plain relaxed loads and stores.
+	 */
+	struct TimerSlot {
+		std::atomic<std::uint64_t> ticks = {0};
+		std::atomic<Count> calls = {0};
+		std::uint64_t start = 0;
+
+		// Allocated by the first call that ends, since most timers of most
+		// threads are never used.
+		std::atomic<ThreadHistogram *> latency = {nullptr};
+
+		// Nesting depth of the timer on this thread. Only the outermost
+		// start/end pair is timed, so recursive calls are not counted twice.
+		std::uint32_t depth = 0;
+
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		std::atomic<std::uint64_t> hardware[HardwareCounters::COUNT] = {};
+		HardwareCounters::Reading hardware_start;
+#endif
+	};
+
+	/**
+	 * @brief      Up to two operands of a timed call, shown as the arguments
+	 *             of its trace event. Names are string literals.
+	 */
+	struct TraceOperands {
+		const char *names[2] = {nullptr, nullptr};
+		std::int64_t values[2] = {0, 0};
+	};
+
+	/**
+	 * @brief      One timed call, in ticks of read_cycle_counter().
+	 */
+	struct TraceEvent {
+		std::uint64_t start = 0;
+		std::uint64_t ticks = 0;
+		Id id = 0;
+		TraceOperands operands;
+	};
+
+	/**
+	 * @brief      The timers and counters of one thread.
+	 */
+	struct ThreadStatistics {
+		TimerSlot timers[LHF_PROFILER_MAX_IDS];
+		std::atomic<Count> counters[LHF_PROFILER_MAX_IDS] = {};
+		std::atomic<ThreadHistogram *> values[LHF_PROFILER_MAX_IDS] = {};
+
+#ifdef LHF_ENABLE_TRACING
+		// Ring buffer of the most recent calls, allocated by the first one.
+		std::vector<TraceEvent> trace;
+
+		// Calls traced so far, including the ones since overwritten.
+		Count traced = 0;
+
+		// The thread's ID in the trace (its order of registration).
+		std::uint32_t thread = 0;
+#endif
 
-		long double getCurrentDurationMilliseconds() {
-			return (std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch())
-						.count() -
-					std::chrono::duration_cast<std::chrono::microseconds>(t1.time_since_epoch())
-						.count()) /
-				   1000.0;
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		// Opened by the thread itself, since ThreadStatistics are created
+		// in local().
+		HardwareCounters hardware;
+#endif
+
+		~ThreadStatistics() {
+			for (std::size_t id = 0; id < LHF_PROFILER_MAX_IDS; id++) {
+				delete timers[id].latency.load();
+				delete values[id].load();
+			}
 		}
+	};
+
+	/**
+	 * @brief      The statistics a thread records into, one for each
+	 *             PerformanceStatistics it has used, by serial. When the
+	 *             thread exits, the hardware counters of those still alive are
+	 *             closed; their figures stay with their PerformanceStatistics.
+	 */
+	struct ThreadRegistrations {
+		std::vector<std::pair<std::uint64_t, std::weak_ptr<ThreadStatistics>>> entries;
 
-		long double getCumulativeDurationMilliseconds() { return duration; }
+		~ThreadRegistrations() {
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+			for (auto &entry : entries) {
+				if (std::shared_ptr<ThreadStatistics> stats = entry.second.lock()) {
+					stats->hardware.close();
+				}
+			}
+#endif
+		}
 	};
 
+	static std::uint64_t next_serial() {
+		static std::atomic<std::uint64_t> serials = {0};
+		return serials.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Identifies this object to the threads that record into it. Unlike its
+	// address, it is never reused by a later object.
+	const std::uint64_t serial = next_serial();
+
+	// Aggregated by aggregate(), by name.
 	Map<String, Count> counters;
 	Map<String, Duration> timers;
+	Map<String, Histogram> values;
 
-	// Timer Functions
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+	// Also set by aggregate(): whether any thread could open each hardware
+	// counter, and why one could not.
+	bool hardware_available[HardwareCounters::COUNT] = {};
+	String hardware_error;
+#endif
+
+	// Guards everything below.
+	std::mutex mutex;
+
+	Map<String, Id> timer_ids;
+	Map<String, Id> counter_ids;
+	Map<String, Id> value_ids;
+	std::vector<String> timer_names;
+	std::vector<String> counter_names;
+	std::vector<String> value_names;
+
+	// Statistics of every thread that has recorded anything, one entry per
+	// thread. They are kept after their thread exits so that its figures
+	// still count, but their hardware counters are closed then (see
+	// ThreadRegistrations).
+	std::vector<std::shared_ptr<ThreadStatistics>> threads;
+
+	// Tick counter and clock readings taken at construction, from which
+	// ticks are converted to time.
+	const std::uint64_t origin_ticks = read_cycle_counter();
+	const std::chrono::steady_clock::time_point origin_time = std::chrono::steady_clock::now();
 
-	Duration &getTimer(const String &s) {
-		if (timers.count(s) == 0) {
-			timers[s] = Duration{};
+	// Whether timed calls are traced (with LHF_ENABLE_TRACING), so that a
+	// trace can be limited to a phase of interest.
+	std::atomic<bool> tracing = {true};
+
+	// Interning
+
+	Id intern(Map<String, Id> &ids, std::vector<String> &names, const String &s) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto cursor = ids.find(s);
+
+		if (cursor != ids.end()) {
+			return cursor->second;
 		}
 
-		return timers[s];
+		if (names.size() == LHF_PROFILER_MAX_IDS) {
+			throw std::length_error("Too many profiler names (see LHF_PROFILER_MAX_IDS)");
+		}
+
+		Id id = static_cast<Id>(names.size());
+		names.push_back(s);
+		ids.insert({s, id});
+		return id;
+	}
+
+	Id timerId(const String &s) { return intern(timer_ids, timer_names, s); }
+
+	Id counterId(const String &s) { return intern(counter_ids, counter_names, s); }
+
+	Id valueId(const String &s) { return intern(value_ids, value_names, s); }
+
+	/**
+	 * @brief      The statistics of the calling thread.
+	 */
+	ThreadStatistics &local() {
+		thread_local std::uint64_t owner = ~std::uint64_t(0);
+		thread_local ThreadStatistics *mine = nullptr;
+
+		if (owner != serial) {
+			mine = &attach();
+			owner = serial;
+		}
+
+		return *mine;
 	}
 
-	void timerStart(const String &s) {
-		auto &d = getTimer(s);
-		assert(!d.started && "timer already started");
-		d.started = true;
-		d.t1 = std::chrono::steady_clock::now();
+	/**
+	 * @brief      Finds the statistics of the calling thread in this object,
+	 *             registering the thread on first use. A thread that switches
+	 *             between several PerformanceStatistics finds its entry again
+	 *             when it comes back.
+	 */
+	ThreadStatistics &attach() {
+		thread_local ThreadRegistrations registrations;
+		auto &entries = registrations.entries;
+
+		// Entries of destroyed PerformanceStatistics are gone already.
+		entries.erase(std::remove_if(entries.begin(), entries.end(),
+			[](const std::pair<std::uint64_t, std::weak_ptr<ThreadStatistics>> &entry) {
+				return entry.second.expired();
+			}), entries.end());
+
+		for (auto &entry : entries) {
+			if (entry.first == serial) {
+				// Owned by `threads`, so it outlives the shared pointer.
+				return *entry.second.lock();
+			}
+		}
+
+		std::shared_ptr<ThreadStatistics> stats(new ThreadStatistics());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			threads.push_back(stats);
+#ifdef LHF_ENABLE_TRACING
+			stats->thread = static_cast<std::uint32_t>(threads.size() - 1);
+#endif
+		}
+		entries.emplace_back(serial, stats);
+		return *stats;
 	}
 
-	void timerEnd(const String &s) {
-		auto &d = getTimer(s);
-		assert(d.started && "timer already stopped");
-		d.started = false;
-		d.t2 = std::chrono::steady_clock::now();
-		d.duration += d.getCurrentDurationMilliseconds();
+	// Timer Functions
+
+	inline void timerStart(Id id) {
+		ThreadStatistics &stats = local();
+		TimerSlot &t = stats.timers[id];
+		if (t.depth++ == 0) {
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+			// Read before the clock (and after it in timerEnd), so the
+			// system calls are not timed.
+			stats.hardware.read(t.hardware_start);
+#else
+			(void) stats;
+#endif
+			t.start = read_cycle_counter();
+		}
 	}
 
-	// Counter Functions
+	inline void timerEnd(Id id) { timerEnd(id, TraceOperands()); }
 
-	Count &getCounter(const String &s) {
-		if (counters.count(s) == 0) {
-			counters[s] = 0;
+	inline void timerEnd(Id id, const TraceOperands &operands) {
+		ThreadStatistics &stats = local();
+		TimerSlot &t = stats.timers[id];
+		assert(t.depth > 0 && "timer already stopped");
+		if (--t.depth == 0) {
+			const std::uint64_t elapsed = read_cycle_counter() - t.start;
+			bump(t.ticks, elapsed);
+			bump(t.calls, 1);
+			histogram(t.latency).record(elapsed);
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+			HardwareCounters::Reading now;
+			stats.hardware.read(now);
+			for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+				bump(t.hardware[i], HardwareCounters::delta(t.hardware_start, now, i));
+			}
+#endif
+#ifdef LHF_ENABLE_TRACING
+			if (tracing.load(std::memory_order_relaxed)) {
+				if (stats.trace.empty()) {
+					stats.trace.resize(LHF_TRACE_BUFFER_EVENTS);
+				}
+				TraceEvent &e = stats.trace[stats.traced++ % LHF_TRACE_BUFFER_EVENTS];
+				e.start = t.start;
+				e.ticks = elapsed;
+				e.id = id;
+				e.operands = operands;
+			}
+#else
+			(void) operands;
+#endif
 		}
+	}
+
+	void timerStart(const String &s) { timerStart(timerId(s)); }
+
+	void timerEnd(const String &s) { timerEnd(timerId(s)); }
+
+	/**
+	 * @brief      Returns the total of a timer over all threads so far. This
+	 *             is a copy: the totals are rebuilt on every aggregation.
+	 */
+	Duration getTimer(const String &s) {
+		aggregate();
+		return timers[s];
+	}
+
+	// Counter Functions
+
+	inline void incrementCounter(Id id, Count n = 1) {
+		bump(local().counters[id], n);
+	}
+
+	void incrementCounter(const String &s, Count n = 1) { incrementCounter(counterId(s), n); }
 
+	/**
+	 * @brief      Returns the total of a counter over all threads so far. This
+	 *             is a copy; add to a counter with incrementCounter().
+	 */
+	Count getCounter(const String &s) {
+		aggregate();
 		return counters[s];
 	}
 
-	void incrementCounter(const String &s) { getCounter(s)++; }
+	// Value Functions
+
+	inline void recordValue(Id id, std::uint64_t value) {
+		histogram(local().values[id]).record(value);
+	}
+
+	void recordValue(const String &s, std::uint64_t value) { recordValue(valueId(s), value); }
+
+	Histogram getValues(const String &s) {
+		aggregate();
+		return values[s];
+	}
+
+	// Aggregation
+
+	/**
+	 * @brief      Milliseconds per tick of read_cycle_counter(), measured
+	 *             against steady_clock since construction.
+	 */
+	long double millisecondsPerTick() {
+		const std::uint64_t ticks = read_cycle_counter() - origin_ticks;
+		const long double ms =
+			std::chrono::duration<long double, std::milli>(
+				std::chrono::steady_clock::now() - origin_time).count();
+		return ticks == 0 ? 0 : ms / ticks;
+	}
+
+	/**
+	 * @brief      Sums the figures of all threads into `counters`, `timers`
+	 *             and `values`.
+	 */
+	void aggregate() {
+		const long double scale = millisecondsPerTick();
+		std::lock_guard<std::mutex> lock(mutex);
+
+		counters.clear();
+		timers.clear();
+		values.clear();
+
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		hardware_error.clear();
+		for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+			hardware_available[i] = false;
+			for (auto &t : threads) {
+				hardware_available[i] = hardware_available[i] || t->hardware.available(i);
+			}
+		}
+		for (auto &t : threads) {
+			if (!t->hardware.error().empty()) {
+				hardware_error = t->hardware.error();
+				break;
+			}
+		}
+#endif
+
+		for (Id id = 0; id < counter_names.size(); id++) {
+			Count &c = counters[counter_names[id]];
+			for (auto &t : threads) {
+				c += t->counters[id].load(std::memory_order_relaxed);
+			}
+		}
+
+		for (Id id = 0; id < timer_names.size(); id++) {
+			std::uint64_t ticks = 0;
+			Duration &d = timers[timer_names[id]];
+			for (auto &t : threads) {
+				const TimerSlot &slot = t->timers[id];
+				ticks += slot.ticks.load(std::memory_order_relaxed);
+				d.calls += slot.calls.load(std::memory_order_relaxed);
+				if (const ThreadHistogram *h = slot.latency.load(std::memory_order_acquire)) {
+					h->add_to(d.latency);
+				}
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+				for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+					d.hardware[i] += slot.hardware[i].load(std::memory_order_relaxed);
+				}
+#endif
+			}
+			d.duration = ticks * scale;
+			d.milliseconds_per_tick = scale;
+		}
+
+		for (Id id = 0; id < value_names.size(); id++) {
+			Histogram &h = values[value_names[id]];
+			for (auto &t : threads) {
+				if (const ThreadHistogram *v = t->values[id].load(std::memory_order_acquire)) {
+					v->add_to(h);
+				}
+			}
+		}
+	}
 
 	// dump
 
@@ -80,45 +845,237 @@ struct PerformanceStatistics {
 		using namespace std;
 		stringstream s;
 
-		if (counters.size() < 1 && timers.size() < 1) {
+		aggregate();
+
+		if (counters.size() < 1 && timers.size() < 1 && values.size() < 1) {
 			s << endl << "Profiler: No statistics generated" << endl;
 			return s.str();
 		}
 
 		s << endl << "Profiler Statistics:" << endl;
-		for (auto k : counters) {
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		if (!hardware_error.empty()) {
+			s << "    " << "Hardware counters unavailable: " << hardware_error << endl;
+		}
+#endif
+		for (auto &k : counters) {
 			s << "    "
 				 << "'" << k.first << "'"
 				 << ": " << k.second << endl;
 		}
-		for (auto k : timers) {
+		for (auto &k : timers) {
 			s << "    "
 				 << "'" << k.first << "'"
-				 << ": " << k.second.getCumulativeDurationMilliseconds() << " ms" << endl;
+				 << ": " << k.second.getCumulativeDurationMilliseconds() << " ms"
+				 << " (" << k.second.calls << " calls)" << endl;
+			// Single calls, in microseconds
+			s << "        "
+				 << k.second.latency.to_string(k.second.milliseconds_per_tick * 1000, " us") << endl;
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+			String separator = "        ";
+			for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+				if (hardware_available[i]) {
+					s << separator << HardwareCounters::name(i) << " " << k.second.hardware[i];
+					separator = ", ";
+				}
+			}
+			if (separator == ", ") {
+				s << endl;
+			}
+#endif
+		}
+		for (auto &k : values) {
+			s << "    "
+				 << "'" << k.first << "'"
+				 << ": " << k.second.to_string() << endl;
 		}
 
 		return s.str();
 	}
+
+	/**
+	 * @brief      Writes everything dump() reports as members of the object
+	 *             open in `w`: "counters", "timers" (total and per-call
+	 *             durations, and hardware events) and "values". With
+	 *             LHF_ENABLE_HARDWARE_COUNTERS, "hardware_counters" tells which
+	 *             counters could be opened.
+	 */
+	void write_json(JsonWriter &w) {
+		aggregate();
+
+		w.begin_object("counters");
+		for (auto &k : counters) {
+			w.value(k.first, k.second);
+		}
+		w.end_object();
+
+		w.begin_object("timers");
+		for (auto &k : timers) {
+			w.begin_object(k.first)
+			 .value("total_ms", k.second.getCumulativeDurationMilliseconds())
+			 .value("calls", k.second.calls)
+			 .begin_object("latency_us");
+			k.second.latency.write_json(w, k.second.milliseconds_per_tick * 1000);
+			w.end_object();
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+			w.begin_object("hardware");
+			for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+				if (hardware_available[i]) {
+					w.value(HardwareCounters::name(i), k.second.hardware[i]);
+				}
+			}
+			w.end_object();
+#endif
+			w.end_object();
+		}
+		w.end_object();
+
+#ifdef LHF_ENABLE_HARDWARE_COUNTERS
+		// Which counters the "hardware" figures of the timers include
+		w.begin_object("hardware_counters");
+		for (std::size_t i = 0; i < HardwareCounters::COUNT; i++) {
+			w.value(HardwareCounters::name(i), hardware_available[i]);
+		}
+		if (!hardware_error.empty()) {
+			w.value("error", hardware_error);
+		}
+		w.end_object();
+#endif
+
+		w.begin_object("values");
+		for (auto &k : values) {
+			w.begin_object(k.first);
+			k.second.write_json(w);
+			w.end_object();
+		}
+		w.end_object();
+	}
+
+	String dump_json() {
+		JsonWriter w;
+		w.begin_object();
+		write_json(w);
+		w.end_object();
+		return w.str();
+	}
+
+	// Tracing
+
+	void setTracing(bool enabled) { tracing.store(enabled, std::memory_order_relaxed); }
+
+#ifdef LHF_ENABLE_TRACING
+	/**
+	 * @brief      Writes the traced calls of all threads as a Chrome trace
+	 *             event document ("X" events, timestamps in microseconds since
+	 *             construction), to be opened in chrome://tracing or
+	 *             Perfetto. Calls that were overwritten in a full ring buffer
+	 *             are counted under "otherData". Must not run while other
+	 *             threads are making timed calls.
+	 */
+	void writeTrace(std::ostream &out) {
+		const long double us = millisecondsPerTick() * 1000;
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const std::ios_base::fmtflags flags = out.flags();
+		const std::streamsize precision = out.precision();
+		out << std::fixed;
+		out.precision(3);
+
+		Count dropped = 0;
+		bool first = true;
+
+		out << "{\"traceEvents\": [";
+		for (auto &t : threads) {
+			const Count kept = std::min<Count>(t->traced, LHF_TRACE_BUFFER_EVENTS);
+			dropped += t->traced - kept;
+
+			for (Count i = t->traced - kept; i < t->traced; i++) {
+				const TraceEvent &e = t->trace[i % LHF_TRACE_BUFFER_EVENTS];
+				out << (first ? "\n" : ",\n")
+					<< "{\"name\": " << JsonWriter::quote(timer_names[e.id])
+					<< ", \"cat\": \"lhf\", \"ph\": \"X\""
+					<< ", \"ts\": " << (e.start - origin_ticks) * us
+					<< ", \"dur\": " << e.ticks * us
+					<< ", \"pid\": 0, \"tid\": " << t->thread;
+				if (e.operands.names[0] != nullptr) {
+					out << ", \"args\": {";
+					for (int k = 0; k < 2 && e.operands.names[k] != nullptr; k++) {
+						out << (k ? ", " : "") << JsonWriter::quote(e.operands.names[k])
+							<< ": " << e.operands.values[k];
+					}
+					out << "}";
+				}
+				out << "}";
+				first = false;
+			}
+		}
+		out << "\n], \"displayTimeUnit\": \"ms\""
+			<< ", \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	void writeTrace(const String &path) {
+		std::ofstream out(path);
+		if (!out) {
+			throw std::runtime_error("Cannot open trace for writing: " + path);
+		}
+		writeTrace(out);
+	}
+#endif
 };
 
-static PerformanceStatistics __stat;
+inline PerformanceStatistics __stat;
 
 struct __CalcTime {
-	const std::string key;
+	const PerformanceStatistics::Id id;
+	const PerformanceStatistics::TraceOperands operands;
 
-	__CalcTime(const std::string key) : key(key) { __stat.timerStart(key); }
+	__CalcTime(PerformanceStatistics::Id id, PerformanceStatistics::TraceOperands operands = {}) :
+		id(id), operands(operands) { __stat.timerStart(id); }
 
-	~__CalcTime() { __stat.timerEnd(key); }
+	~__CalcTime() { __stat.timerEnd(id, operands); }
 };
 
-#ifdef LHF_ENABLE_PERFORMANCE_METRICS
-#define __lhf_calc_time(key) auto __LHF_TIMER_OBJECT__ = __CalcTime((key))
-#define __lhf_calc_functime() auto __LHF_TIMER_OBJECT__ = __CalcTime(__func__)
+// Each use interns its key once, the first time it runs, so the key of
+// __lhf_calc_time, __lhf_count and __lhf_record must be a string literal (a
+// key that is not one fails to compile). The _dynamic forms take any string,
+// and look it up on every call.
+#ifdef LHF_ENABLE_PROFILER
+#define __LHF_CALC_TIME_INTERNED(key) \
+	static const ::lhf::PerformanceStatistics::Id __LHF_TIMER_ID__ = ::lhf::__stat.timerId((key)); \
+	::lhf::__CalcTime __LHF_TIMER_OBJECT__(__LHF_TIMER_ID__)
+#define __lhf_calc_time(key) __LHF_CALC_TIME_INTERNED("" key)
+#define __lhf_calc_time_dynamic(key) \
+	::lhf::__CalcTime __LHF_TIMER_OBJECT__(::lhf::__stat.timerId((key)))
+#define __lhf_calc_functime() __LHF_CALC_TIME_INTERNED(__func__)
+// Like __lhf_calc_functime(), and traces the two operands under their names.
+#define __lhf_calc_functime_operands(a, b) \
+	static const ::lhf::PerformanceStatistics::Id __LHF_TIMER_ID__ = ::lhf::__stat.timerId(__func__); \
+	::lhf::__CalcTime __LHF_TIMER_OBJECT__(__LHF_TIMER_ID__, \
+		{{#a, #b}, {static_cast<std::int64_t>(a), static_cast<std::int64_t>(b)}})
+#define __lhf_count(key) { \
+	static const ::lhf::PerformanceStatistics::Id __LHF_COUNTER_ID__ = ::lhf::__stat.counterId("" key); \
+	::lhf::__stat.incrementCounter(__LHF_COUNTER_ID__); \
+}
+#define __lhf_count_dynamic(key) ::lhf::__stat.incrementCounter(::lhf::String(key))
+#define __lhf_record(key, value) { \
+	static const ::lhf::PerformanceStatistics::Id __LHF_VALUE_ID__ = ::lhf::__stat.valueId("" key); \
+	::lhf::__stat.recordValue(__LHF_VALUE_ID__, (value)); \
+}
+#define __lhf_record_dynamic(key, value) ::lhf::__stat.recordValue(::lhf::String(key), (value))
 #else
 #define __lhf_calc_time(key)
+#define __lhf_calc_time_dynamic(key)
 #define __lhf_calc_functime()
+#define __lhf_calc_functime_operands(a, b)
+#define __lhf_count(key)
+#define __lhf_count_dynamic(key)
+#define __lhf_record(key, value)
+#define __lhf_record_dynamic(key, value)
 #endif
 
 }
 
-#endif
\ No newline at end of file
+#endif